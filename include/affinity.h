@@ -0,0 +1,57 @@
+/*
+ * Author: Giannis Giakoumakis
+ * Contact: giannis.m.giakoumakis@gmail.com
+ *
+ * CPU affinity policies of the benchmark threads.
+ *
+ * compact  fill the CPUs of one NUMA node before moving to
+ *          the next one, so threads share caches
+ * scatter  spread consecutive threads over the NUMA nodes
+ *          round robin
+ * list     pin thread i to the i-th CPU of an explicit list
+ *          such as "0,2,8-11"
+ *
+ * With more threads than CPUs the order wraps around.
+ */
+
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <pthread.h>
+
+enum affinity_kind {
+	AFFINITY_NONE, /* leave placement to the scheduler */
+	AFFINITY_COMPACT,
+	AFFINITY_SCATTER,
+	AFFINITY_LIST
+};
+
+struct affinity {
+	enum affinity_kind kind;
+	const char *name; /* as given on the command line */
+	int *cpus; /* CPU of thread i is cpus[i % ncpus] */
+	int ncpus;
+};
+
+/*
+ * Parse "none", "compact", "scatter" or a CPU list.
+ * Return 0 on success, -1 if the policy is malformed or
+ * names a CPU the process may not run on.
+ */
+int parse_affinity(struct affinity *, const char *);
+
+/* CPU of the i-th thread, -1 if threads are not pinned */
+int affinity_cpu(struct affinity *, int);
+
+/*
+ * Initialize attributes that create the i-th thread on its
+ * CPU.
+ */
+void affinity_attr(struct affinity *, int, pthread_attr_t *);
+
+/* Pin the calling thread as the i-th thread */
+void affinity_apply(struct affinity *, int);
+
+void free_affinity(struct affinity *);
+
+#endif /* AFFINITY_H */
@@ -0,0 +1,200 @@
+/*
+ * Author: Giannis Giakoumakis
+ * Contact: giannis.m.giakoumakis@gmail.com
+ *
+ * Interface tables of every queue and ordered map
+ * implementation, so that a benchmark can pick one at
+ * run time by name.
+ */
+
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include "common_structs.h"
+#include "conbst.h"
+#include "conqueue.h"
+
+struct queue_ops {
+	const char *name;
+
+	/* Allocate and initialize an empty queue */
+	void * (*create)(void);
+
+	/*
+	 * Optional, NULL if the queue cannot be bounded. Limit a
+	 * new queue to n items, enqueue then waits for space.
+	 */
+	void (*bound)(void *, int);
+
+	void (*enqueue)(void *, int, int);
+
+	/*
+	 * Copy the dequeued value out.
+	 * Return 1 if the queue was not empty, 0 otherwise.
+	 */
+	int (*dequeue)(void *, struct info *);
+
+	/*
+	 * Optional, NULL if the queue cannot carry tree nodes.
+	 * Same contract as enqueue_node()/dequeue_node(), with
+	 * tree nodes, so a node can move into a map as is.
+	 */
+	void (*enqueue_node)(void *, struct tree_node *);
+	struct tree_node * (*dequeue_node)(void *);
+
+	/*
+	 * Optional, NULL if the queue cannot tell. Number of
+	 * items, exact if the int is nonzero, else a cheap
+	 * estimate that may miss operations in progress.
+	 */
+	long (*size)(void *, int);
+
+	/*
+	 * Enqueue and dequeue n items calling the implementation
+	 * directly, to measure the cost of the dispatch.
+	 */
+	void (*direct)(void *, int);
+
+	/* Free a queue and everything in it, single threaded */
+	void (*destroy)(void *);
+};
+
+struct map_ops {
+	const char *name;
+
+	/* Allocate and initialize an empty map */
+	void * (*create)(void);
+
+	void (*insert)(void *, int, int);
+
+	/*
+	 * Copy the value of the deleted key out.
+	 * Return 1 if the key existed, 0 otherwise.
+	 */
+	int (*delete)(void *, int, struct info *);
+
+	/*
+	 * Delete the smallest key and copy its value out.
+	 * Return 1 if the map was not empty, 0 otherwise.
+	 */
+	int (*delete_min)(void *, struct info *);
+
+	/*
+	 * Copy the value of a key out.
+	 * Return 1 if the key exists, 0 otherwise.
+	 */
+	int (*lookup)(void *, int, struct info *);
+
+	/*
+	 * Optional, NULL if the map cannot look keys up in
+	 * batches. Same contract as lookup_batch().
+	 */
+	int (*lookup_batch)(void *, const int *, int, struct info *, int *);
+
+	/*
+	 * Optional, NULL if the map is not made of tree nodes.
+	 * Same contract as insert_node()/delete_node().
+	 */
+	int (*insert_node)(void *, struct tree_node *);
+	struct tree_node * (*delete_node)(void *, int);
+
+	/*
+	 * Optional, NULL if the map cannot wait for a key. Same
+	 * contract as wait_and_delete_node().
+	 */
+	struct tree_node * (*wait_delete_node)(void *, int, long);
+
+	/* Optional, NULL if the map cannot tell. As in queue_ops. */
+	long (*size)(void *, int);
+
+	/* Insert and delete n keys calling the implementation directly */
+	void (*direct)(void *, int);
+
+	/* Free a map and everything in it, single threaded */
+	void (*destroy)(void *);
+};
+
+/* NULL terminated lists of every implementation, default first */
+extern const struct queue_ops *queue_backends[];
+extern const struct map_ops *map_backends[];
+
+extern const struct queue_ops lockqueue_ops;
+extern const struct map_ops bst_ops;
+
+/* Look an implementation up by name, NULL if there is none */
+const struct queue_ops * find_queue_ops(const char *);
+const struct map_ops * find_map_ops(const char *);
+
+/*
+ * Measure the extra cost (in nanoseconds per operation) of
+ * going through the interface table instead of calling the
+ * implementation directly, using n operations. 0 when the
+ * difference is lost in the noise.
+ */
+double queue_dispatch_ns(const struct queue_ops *, int);
+double map_dispatch_ns(const struct map_ops *, int);
+
+/*
+ * The default implementations are called directly, so
+ * they pay no indirect call: enqueue(), enqueue_node() and
+ * dequeue_node() of the lock queue and insert_node() and
+ * delete_node() of the BST. Every other operation, including
+ * a plain dequeue, and every other backend go through the
+ * table. Define _NO_FAST_PATH to dispatch everything.
+ */
+static inline void
+queue_enqueue(const struct queue_ops *ops, void *q, int pid, int ts)
+{
+#ifndef _NO_FAST_PATH
+	if (ops == &lockqueue_ops) {
+		enqueue(q, pid, ts);
+		return;
+	}
+#endif
+	ops->enqueue(q, pid, ts);
+}
+
+static inline void
+queue_enqueue_node(const struct queue_ops *ops, void *q,
+    struct tree_node *n)
+{
+#ifndef _NO_FAST_PATH
+	if (ops == &lockqueue_ops) {
+		enqueue_node(q, &n->qnode);
+		return;
+	}
+#endif
+	ops->enqueue_node(q, n);
+}
+
+static inline struct tree_node *
+queue_dequeue_node(const struct queue_ops *ops, void *q)
+{
+#ifndef _NO_FAST_PATH
+	if (ops == &lockqueue_ops)
+		return (struct tree_node *)dequeue_node(q);
+#endif
+	return ops->dequeue_node(q);
+}
+
+static inline int
+map_insert_node(const struct map_ops *ops, void *t, struct tree_node *n)
+{
+#ifndef _NO_FAST_PATH
+	if (ops == &bst_ops)
+		return insert_node(t, n);
+#endif
+	return ops->insert_node(t, n);
+}
+
+static inline struct tree_node *
+map_delete_node(const struct map_ops *ops, void *t, int ts)
+{
+#ifndef _NO_FAST_PATH
+	if (ops == &bst_ops)
+		return delete_node(t, ts);
+#endif
+	return ops->delete_node(t, ts);
+}
+
+#endif /* BACKEND_H */
@@ -0,0 +1,93 @@
+/*
+ * Author: Giannis Giakoumakis
+ * Contact: giannis.m.giakoumakis@gmail.com
+ *
+ * Capacity bounds of the linked queues. A bound counts the
+ * items in a queue and, once capacity items are in, makes
+ * enqueuers either fail fast (bound_try()) or park until a
+ * dequeue frees a slot (bound_wait()). Optional high and low
+ * watermarks call back when the count crosses them, with
+ * hysteresis: the low mark is reported only after the high
+ * one was, and the other way round.
+ *
+ * An unused bound (no capacity and no watermarks) costs a
+ * branch per operation and counts nothing.
+ */
+
+#ifndef BOUND_H
+#define BOUND_H
+
+#include <pthread.h>
+
+/*
+ * Called with the queue, 1 when the count reaches the high
+ * watermark and 0 when it drops to the low one, and the
+ * caller's argument. It runs in the enqueuing or dequeuing
+ * thread, one call at a time, so it should be short.
+ */
+typedef void (*watermark_fn)(void *, int, void *);
+
+struct bound {
+	int active;		/* any of the below is set */
+	int capacity;		/* 0 for no limit */
+	int count;		/* items in the queue */
+	int waiters;		/* enqueuers parked on space */
+	int high;
+	int low;
+	int above;		/* the high mark was reported last */
+	pthread_mutex_t marklock; /* orders the watermark reports */
+	watermark_fn watermark;
+	void *arg;
+	void *queue;		/* passed to watermark */
+	pthread_mutex_t lock;
+	pthread_cond_t space;
+};
+
+/* An unused bound of the given queue */
+void initbound(struct bound *, void *);
+
+void destroybound(struct bound *);
+
+/*
+ * Limit the queue to capacity items, 0 for no limit. Only
+ * before the queue is shared.
+ */
+void setcapacity(struct bound *, int);
+
+/*
+ * Call fn(queue, 1, arg) when the count rises to high and
+ * fn(queue, 0, arg) when it falls back to low, low < high.
+ * NULL fn removes the watermarks. Only before the queue is
+ * shared.
+ */
+void setwatermarks(struct bound *, int, int, watermark_fn, void *);
+
+/* Slow paths of the functions below, for an active bound */
+int bound_take(struct bound *);
+void bound_park(struct bound *);
+void bound_give(struct bound *);
+
+/* Take a slot for one item. Return 0 if the queue is full. */
+static inline int
+bound_try(struct bound *b)
+{
+	return b->active ? bound_take(b) : 1;
+}
+
+/* Take a slot for one item, waiting for one if needed */
+static inline void
+bound_wait(struct bound *b)
+{
+	if (b->active && !bound_take(b))
+		bound_park(b);
+}
+
+/* Give the slot of a dequeued item back */
+static inline void
+bound_release(struct bound *b)
+{
+	if (b->active)
+		bound_give(b);
+}
+
+#endif /* BOUND_H */
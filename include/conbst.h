@@ -14,17 +14,45 @@
 #include <pthread.h>
 
 #include "common_structs.h"
+#include "counter.h"
+#include "lock.h"
+#include "conqueue.h"
 
 struct tree {
 	struct tree_node *root;
-	pthread_mutex_t tree_lock;
+	struct lock tree_lock;
+	struct counter size;	/* nodes, see tree_size_approx() */
 };
 
+/*
+ * A tree node starts with a queue node, so a node can travel
+ * through a struct queue (see enqueue_node()/dequeue_node())
+ * and then be linked into the tree as is.
+ */
 struct tree_node {
-	struct info inf;
-	pthread_mutex_t lock;
-	struct tree_node *lc;
-	struct tree_node *rc;
+	union {
+		struct queue_node qnode;
+		struct info inf;
+	};
+	struct lock lock;
+	union {
+		struct {
+			struct tree_node *lc;
+			struct tree_node *rc;
+		};
+		/* child[key > inf.timestamp], for branchless descents */
+		struct tree_node *child[2];
+	};
+};
+
+/*
+ * A consistent copy of the keys of a BST that fall into a
+ * range, sorted in increasing order.
+ */
+struct tree_snapshot {
+	struct info *items;
+	int nitems;
+	int pos;
 };
 
 #ifdef _UTEST
@@ -35,17 +63,60 @@ struct product {
 	pthread_t *tid;
 	pthread_barrier_t barrier;
 };
+
+/* Keys a range scan went through, in the order it did */
+struct scan {
+	const char *name;
+	int n;
+	int keys[16];
+};
 #endif /* _UTEST */
 
 /* Initialization of a BST */
 void inittree(struct tree *);
 
-/* In-order print of a BST using recursion */
+/*
+ * Free every node of a BST, leaving it empty. No other
+ * thread may use the tree meanwhile.
+ */
+void destroytree(struct tree *);
+
+/* Free a subtree that is no longer part of any BST */
+void destroysubtree(struct tree_node *);
+
+/*
+ * In-order print of a BST using recursion.
+ * Not safe while other threads modify the tree,
+ * use range_scan() instead.
+ */
 void print_inorder(struct tree_node *);
 
+/*
+ * Allocate and initialize a tree node that is not part
+ * of any BST yet. It comes from node_alloc(), so it must
+ * be released with destroylock() on its lock and then
+ * node_free(), never with free().
+ */
+struct tree_node * alloctreenode(int, int);
+
 /* Insert a new node into a BST */
 void insert(struct tree *, int, int);
 
+/*
+ * Insert a node returned by alloctreenode() into a BST.
+ * Return 1 if the BST owns the node afterwards, 0 if its
+ * key is a duplicate, in which case the caller keeps it.
+ */
+int insert_node(struct tree *, struct tree_node *);
+
+/*
+ * Insert an array of values, sorted in increasing timestamp
+ * order, into a BST. Runs of values that fall into the same
+ * empty subtree are linked there as a balanced subtree after
+ * a single descent. Duplicate keys are ignored.
+ */
+void insert_bulk(struct tree *, struct info *, int);
+
 /*
  * Delete a node from a BST.
  * Return the value of the deleted node if it
@@ -53,6 +124,102 @@ void insert(struct tree *, int, int);
  */
 struct info * delete(struct tree *, int);
 
+/*
+ * Delete a node from a BST without copying it out.
+ * Return a node that is no longer part of the BST and
+ * holds the deleted value if it exists, NULL otherwise.
+ * The caller owns the returned node.
+ */
+struct tree_node * delete_node(struct tree *, int);
+
+/*
+ * Delete a node from a BST like delete() does, but if the
+ * key is not there, sleep until an insertion publishes it
+ * and delete it then, or until the timeout (nanoseconds)
+ * passes. A negative timeout waits for ever, 0 does not wait.
+ * Return the value of the deleted node, NULL on timeout.
+ */
+struct info * wait_and_delete(struct tree *, int, long);
+
+/* Same as wait_and_delete(), returning the node like delete_node() */
+struct tree_node * wait_and_delete_node(struct tree *, int, long);
+
+/*
+ * Delete the node with the smallest (delete_min) or the
+ * largest (delete_max) key from a BST, which turns the
+ * tree into a concurrent priority queue.
+ * Return the value of the deleted node if the tree is
+ * not empty, NULL otherwise.
+ */
+struct info * delete_min(struct tree *);
+struct info * delete_max(struct tree *);
+
+/*
+ * Copy the value of a key out of a BST.
+ * Return 1 if the key exists, 0 otherwise.
+ */
+int lookup(struct tree *, int, struct info *);
+
+/*
+ * Look n keys, sorted in increasing order, up at once. The
+ * descents go down the tree together, a level at a time, so
+ * the cache misses of one overlap with the work on the others.
+ * The value of keys[i] is copied to out[i] and found[i] is set
+ * to 1 if it exists, to 0 otherwise. Return the number of keys
+ * found. The lookups are linearizable as a whole, like a
+ * snapshot.
+ */
+int lookup_batch(struct tree *, const int *, int, struct info *, int *);
+
+/*
+ * Delete every node of a BST whose key lies in [lo, hi] in one
+ * operation and rebalance the part of the tree around the range.
+ * Return the number of deleted nodes.
+ */
+int delete_range(struct tree *, int, int);
+
+/*
+ * Take a snapshot of every node of a BST whose key lies in
+ * [lo, hi]. The snapshot is linearizable with respect to
+ * concurrent insertions and deletions and has to be released
+ * with snapshot_free().
+ */
+void snapshot_tree(struct tree *, int, int, struct tree_snapshot *);
+
+/*
+ * Iterate over a snapshot in increasing key order.
+ * Return the next value, NULL when the snapshot is exhausted.
+ */
+struct info * snapshot_next(struct tree_snapshot *);
+
+/* Release the memory held by a snapshot */
+void snapshot_free(struct tree_snapshot *);
+
+/*
+ * Call a function for every value of a BST whose key lies in
+ * [lo, hi], in increasing key order. The values are taken from
+ * a snapshot, so the callback runs without holding any lock.
+ */
+void range_scan(struct tree *, int, int,
+    void (*)(struct info *, void *), void *);
+
+/*
+ * Number of nodes of a BST, counted by a linearizable walk
+ * of the whole tree like snapshot_tree() does.
+ */
+long tree_size(struct tree *);
+
+/*
+ * Number of nodes of a BST from a counter that insertions
+ * and deletions update after the fact, in a shard of their
+ * own (see counter.h). Cheap, but it may miss operations in
+ * progress.
+ */
+long tree_size_approx(struct tree *);
+
+/* Return 1 if a BST is empty, 0 otherwise */
+int tree_is_empty(struct tree *);
+
 /*
  * Helper function to find the node that should
  * be physically deleted from a BST if it
@@ -0,0 +1,356 @@
+/*
+ * Author: Giannis Giakoumakis
+ * Contact: giannis.m.giakoumakis@gmail.com
+ *
+ * Type generic versions of the concurrent queue and the
+ * concurrent binary search tree.
+ *
+ * DEFINE_QUEUE(name, T) stamps out a two-lock queue of T
+ * values (same algorithm as conqueue.c), named struct name,
+ * with name_init(), name_enqueue(), name_dequeue() and
+ * name_destroy().
+ *
+ * DEFINE_TREE(name, K, V, cmp) stamps out a fine grain
+ * locking binary search tree (same locking scheme as
+ * conbst.c) mapping K keys to V values, named struct name,
+ * with name_init(), name_insert(), name_delete(),
+ * name_delete_min(), name_find() and name_destroy().
+ * cmp(a, b) must evaluate to a negative value, zero or a
+ * positive value when a is smaller than, equal to or
+ * greater than b. It is expanded in place, so a macro or a
+ * static inline function is inlined into the descent.
+ *
+ * Values are stored inside the nodes and copied out into
+ * caller provided storage, so no function pointer, void
+ * pointer or extra allocation is involved in any operation.
+ */
+
+#ifndef CONGENERIC_H
+#define CONGENERIC_H
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "nodealloc.h"
+
+/* Comparator for any type that supports the relational operators */
+#define GENERIC_CMP(a, b) (((a) > (b)) - ((a) < (b)))
+
+#define DEFINE_QUEUE(name, T)						\
+struct name##_node {							\
+	T val;								\
+	struct name##_node *next;					\
+};									\
+									\
+struct name {								\
+	struct name##_node *Head;					\
+	struct name##_node *Tail;					\
+	pthread_mutex_t head_lock;					\
+	pthread_mutex_t tail_lock;					\
+};									\
+									\
+/* Initialization of a queue, with a sentinel node */		\
+static inline void							\
+name##_init(struct name *q)						\
+{									\
+	struct name##_node *node;					\
+									\
+	node = node_alloc(sizeof(struct name##_node));			\
+	node->next = NULL;						\
+	q->Head = node;							\
+	q->Tail = node;							\
+	if (pthread_mutex_init(&q->head_lock, NULL) != 0 ||		\
+	    pthread_mutex_init(&q->tail_lock, NULL) != 0) {		\
+		printf("pthread_mutex_init() failed\n");		\
+		exit(EXIT_FAILURE);					\
+	}								\
+}									\
+									\
+/* Enqueue a copy of val */						\
+static inline void							\
+name##_enqueue(struct name *q, T val)					\
+{									\
+	struct name##_node *node;					\
+									\
+	node = node_alloc(sizeof(struct name##_node));			\
+	node->val = val;						\
+	node->next = NULL;						\
+									\
+	pthread_mutex_lock(&q->tail_lock);				\
+	q->Tail->next = node;						\
+	q->Tail = node;							\
+	pthread_mutex_unlock(&q->tail_lock);				\
+}									\
+									\
+/*									\
+ * Dequeue into *val.							\
+ * Return 1 if the queue was not empty, 0 otherwise.			\
+ */									\
+static inline int							\
+name##_dequeue(struct name *q, T *val)					\
+{									\
+	struct name##_node *tmp;					\
+									\
+	pthread_mutex_lock(&q->head_lock);				\
+	if (q->Head->next == NULL) {					\
+		pthread_mutex_unlock(&q->head_lock);			\
+		return 0;						\
+	}								\
+	*val = q->Head->next->val;					\
+	tmp = q->Head;							\
+	q->Head = q->Head->next;					\
+	pthread_mutex_unlock(&q->head_lock);				\
+	node_free(tmp);							\
+	return 1;							\
+}									\
+									\
+/* Free every node, no other thread may use the queue */		\
+static inline void							\
+name##_destroy(struct name *q)						\
+{									\
+	struct name##_node *node;					\
+									\
+	while ((node = q->Head) != NULL) {				\
+		q->Head = node->next;					\
+		node_free(node);					\
+	}								\
+	q->Tail = NULL;							\
+	pthread_mutex_destroy(&q->head_lock);				\
+	pthread_mutex_destroy(&q->tail_lock);				\
+}
+
+#define DEFINE_TREE(name, K, V, cmp)					\
+struct name##_node {							\
+	K key;								\
+	V val;								\
+	pthread_mutex_t lock;						\
+	struct name##_node *lc;						\
+	struct name##_node *rc;						\
+};									\
+									\
+struct name {								\
+	struct name##_node *root;					\
+	pthread_mutex_t tree_lock;					\
+};									\
+									\
+/* Initialization of an empty tree */					\
+static inline void							\
+name##_init(struct name *t)						\
+{									\
+	t->root = NULL;							\
+	if (pthread_mutex_init(&t->tree_lock, NULL) != 0) {		\
+		printf("pthread_mutex_init() failed\n");		\
+		exit(EXIT_FAILURE);					\
+	}								\
+}									\
+									\
+/*									\
+ * Hand over hand descent towards key. On return *plock		\
+ * (the tree lock or the lock of the parent) protects *link,		\
+ * the pointer that leads to the returned node. The returned		\
+ * node is either locked and holds key, or NULL.			\
+ */									\
+static inline struct name##_node *					\
+name##_search(struct name *t, K key, pthread_mutex_t **plock,		\
+    struct name##_node ***link)						\
+{									\
+	struct name##_node *curr;					\
+	int c;								\
+									\
+	*plock = &t->tree_lock;						\
+	*link = &t->root;						\
+	pthread_mutex_lock(*plock);					\
+	while ((curr = **link) != NULL) {				\
+		pthread_mutex_lock(&curr->lock);			\
+		c = cmp(key, curr->key);				\
+		if (c == 0)						\
+			break;						\
+		pthread_mutex_unlock(*plock);				\
+		*plock = &curr->lock;					\
+		*link = (c < 0) ? &curr->lc : &curr->rc;		\
+	}								\
+	return curr;							\
+}									\
+									\
+/*									\
+ * Insert key mapped to val.						\
+ * Return 1 on success, 0 if key is already in the tree.		\
+ */									\
+static inline int							\
+name##_insert(struct name *t, K key, V val)				\
+{									\
+	struct name##_node *node, *curr, **link;			\
+	pthread_mutex_t *plock;						\
+									\
+	node = node_alloc(sizeof(struct name##_node));			\
+	node->key = key;						\
+	node->val = val;						\
+	node->lc = NULL;						\
+	node->rc = NULL;						\
+	if (pthread_mutex_init(&node->lock, NULL) != 0) {		\
+		printf("pthread_mutex_init() failed\n");		\
+		exit(EXIT_FAILURE);					\
+	}								\
+									\
+	curr = name##_search(t, key, &plock, &link);			\
+	if (curr != NULL) { /* found duplicate */			\
+		pthread_mutex_unlock(&curr->lock);			\
+		pthread_mutex_unlock(plock);				\
+		pthread_mutex_destroy(&node->lock);			\
+		node_free(node);					\
+		return 0;						\
+	}								\
+	*link = node;							\
+	pthread_mutex_unlock(plock);					\
+	return 1;							\
+}									\
+									\
+/*									\
+ * Copy the value mapped to key into *val.				\
+ * Return 1 if key was found, 0 otherwise.				\
+ */									\
+static inline int							\
+name##_find(struct name *t, K key, V *val)				\
+{									\
+	struct name##_node *curr, **link;				\
+	pthread_mutex_t *plock;						\
+									\
+	curr = name##_search(t, key, &plock, &link);			\
+	if (curr != NULL) {						\
+		*val = curr->val;					\
+		pthread_mutex_unlock(&curr->lock);			\
+	}								\
+	pthread_mutex_unlock(plock);					\
+	return curr != NULL;						\
+}									\
+									\
+/*									\
+ * Delete key and copy the value it was mapped to into *val		\
+ * (if val is not NULL).						\
+ * Return 1 if key was found, 0 otherwise.				\
+ */									\
+static inline int							\
+name##_delete(struct name *t, K key, V *val)				\
+{									\
+	struct name##_node *curr, *pred, *pparent, *next, **link;	\
+	pthread_mutex_t *plock;						\
+									\
+	curr = name##_search(t, key, &plock, &link);			\
+	if (curr == NULL) {						\
+		pthread_mutex_unlock(plock);				\
+		return 0;						\
+	}								\
+	if (val != NULL)						\
+		*val = curr->val;					\
+									\
+	if (curr->lc == NULL || curr->rc == NULL) {			\
+	/*								\
+	 * At most one child, splice the node out. Nobody can		\
+	 * wait for its lock, since *plock is held.			\
+	 */								\
+		*link = (curr->lc != NULL) ? curr->lc : curr->rc;	\
+		pthread_mutex_unlock(&curr->lock);			\
+		pthread_mutex_unlock(plock);				\
+		pthread_mutex_destroy(&curr->lock);			\
+		node_free(curr);					\
+		return 1;						\
+	}								\
+									\
+	/*								\
+	 * Two children, move the predecessor into the node and		\
+	 * unlink the predecessor instead. *link does not change.	\
+	 */								\
+	pthread_mutex_unlock(plock);					\
+	pparent = NULL;							\
+	pred = curr->lc;						\
+	pthread_mutex_lock(&pred->lock);				\
+	while ((next = pred->rc) != NULL) {				\
+		pthread_mutex_lock(&next->lock);			\
+		if (pparent != NULL)					\
+			pthread_mutex_unlock(&pparent->lock);		\
+		pparent = pred;						\
+		pred = next;						\
+	}								\
+	if (pparent != NULL)						\
+		pparent->rc = pred->lc;					\
+	else								\
+		curr->lc = pred->lc;					\
+	curr->key = pred->key;						\
+	curr->val = pred->val;						\
+	pthread_mutex_unlock(&pred->lock);				\
+	if (pparent != NULL)						\
+		pthread_mutex_unlock(&pparent->lock);			\
+	pthread_mutex_unlock(&curr->lock);				\
+	pthread_mutex_destroy(&pred->lock);				\
+	node_free(pred);						\
+	return 1;							\
+}									\
+									\
+/*									\
+ * Delete the smallest key, copying it into *key and its		\
+ * value into *val (either may be NULL).				\
+ * Return 1 if the tree was not empty, 0 otherwise.			\
+ */									\
+static inline int							\
+name##_delete_min(struct name *t, K *key, V *val)			\
+{									\
+	struct name##_node *curr, *next, **link;			\
+	pthread_mutex_t *plock;						\
+									\
+	plock = &t->tree_lock;						\
+	link = &t->root;						\
+	pthread_mutex_lock(plock);					\
+	if ((curr = *link) == NULL) {					\
+		pthread_mutex_unlock(plock);				\
+		return 0;						\
+	}								\
+	pthread_mutex_lock(&curr->lock);				\
+	while ((next = curr->lc) != NULL) {				\
+		pthread_mutex_lock(&next->lock);			\
+		pthread_mutex_unlock(plock);				\
+		plock = &curr->lock;					\
+		link = &curr->lc;					\
+		curr = next;						\
+	}								\
+	if (key != NULL)						\
+		*key = curr->key;					\
+	if (val != NULL)						\
+		*val = curr->val;					\
+	/* no left child, splice the node out as in name_delete() */	\
+	*link = curr->rc;						\
+	pthread_mutex_unlock(&curr->lock);				\
+	pthread_mutex_unlock(plock);					\
+	pthread_mutex_destroy(&curr->lock);				\
+	node_free(curr);						\
+	return 1;							\
+}									\
+									\
+/*									\
+ * Free every node, no other thread may use the tree.			\
+ * Rotations flatten the tree on the way, so no stack is needed.	\
+ */									\
+static inline void							\
+name##_destroy(struct name *t)						\
+{									\
+	struct name##_node *n, *l;					\
+									\
+	n = t->root;							\
+	while (n != NULL) {						\
+		if (n->lc != NULL) {					\
+			l = n->lc;					\
+			n->lc = l->rc;					\
+			l->rc = n;					\
+			n = l;						\
+		} else {						\
+			l = n->rc;					\
+			pthread_mutex_destroy(&n->lock);		\
+			node_free(n);					\
+			n = l;						\
+		}							\
+	}								\
+	t->root = NULL;							\
+	pthread_mutex_destroy(&t->tree_lock);				\
+}
+
+#endif /* CONGENERIC_H */
@@ -3,11 +3,15 @@
  * Author: Giannis Giakoumakis
  * Contact: giannis.m.giakoumakis@gmail.com
  *
- * A concurrent unbounded lock free queue.
+ * A concurrent lock free queue.
  * The first node in the queue is a sentinel node,
  * whose value is meaningless.
  * Threads may need to help each other to ensure
  * lock-freedom.
+ * The queue is unbounded, unless it is given a capacity
+ * with setcapacity(&q->bound, ...) before it is shared
+ * (see bound.h). Waiting for space in a full queue is not
+ * lock free.
  */
 
 #ifndef CONLFQUEUE_H
@@ -15,16 +19,24 @@
 
 #include <pthread.h>
 
+#include "bound.h"
 #include "common_structs.h"
 
 struct lfqueue {
 	struct lfqueue_node *Head;
 	struct lfqueue_node *Tail;
+	struct bound bound;
 };
 
+/*
+ * seq numbers the nodes in enqueue order (the sentinel is 0),
+ * so the size of the queue is the seq of the last node minus
+ * the seq of the head.
+ */
 struct lfqueue_node {
 	struct info inf;
 	struct lfqueue_node *next;
+	long seq;
 };
 
 #ifdef _UTEST
@@ -37,9 +49,18 @@ struct thrdfuncargs {
 /* Initialization of a lock free queue */
 void initlfqueue(struct lfqueue *);
 
-/* Enqueue a new node into a lock free queue */
+/*
+ * Enqueue a new node into a lock free queue, waiting for
+ * space if the queue is full
+ */
 void lfenqueue(struct lfqueue *, int, int);
 
+/*
+ * Enqueue a new node into a lock free queue if it is not
+ * full. Return 1 on success, 0 if the queue is full.
+ */
+int lftry_enqueue(struct lfqueue *, int, int);
+
 /*
  * Delete a node from a lock free queue.
  * Return the value of the deleted node if
@@ -47,5 +68,25 @@ void lfenqueue(struct lfqueue *, int, int);
  */
 struct info * lfdequeue(struct lfqueue *);
 
+/*
+ * Number of values in a lock free queue, as of one moment
+ * during the call. Lock free, it retries while dequeues
+ * move the head.
+ */
+long lfsize(struct lfqueue *);
+
+/*
+ * Number of values in a lock free queue, reading the head
+ * and the tail once. The tail may lag behind or move on
+ * meanwhile, so the result is only close.
+ */
+long lfsize_approx(struct lfqueue *);
+
+/*
+ * Return 1 if a lock free queue is empty, 0 otherwise.
+ * Unlike lfdequeue(), it allocates nothing.
+ */
+int lfis_empty(struct lfqueue *);
+
 #endif /* CONLFQUEUE_H */
 
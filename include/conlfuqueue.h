@@ -0,0 +1,73 @@
+/*
+ * Author: Giannis Giakoumakis
+ * Contact: giannis.m.giakoumakis@gmail.com
+ *
+ * A concurrent unbounded lock free queue whose nodes
+ * (blocks) hold LFUQUEUE_BLOCK items each, after the
+ * Michael-Scott queue. Within a block, enqueuers and
+ * dequeuers claim slots with a fetch-and-add on the
+ * block's enqueue and dequeue indices, so the head and
+ * tail pointers are only CASed once per block. A slot is
+ * filled by its enqueuer and then marked FULL; a dequeuer
+ * that reaches a slot before it is full marks it TAKEN, and
+ * the enqueuer moves on to another slot.
+ *
+ * Like conlfqueue.c, blocks are not freed while the queue
+ * is in use (other threads may still read them), only by
+ * destroylfuqueue().
+ */
+
+#ifndef CONLFUQUEUE_H
+#define CONLFUQUEUE_H
+
+#include "common_structs.h"
+
+#define LFUQUEUE_BLOCK 64
+
+/* States of a slot */
+#define LFUQUEUE_EMPTY 0
+#define LFUQUEUE_FULL 1
+#define LFUQUEUE_TAKEN 2
+
+struct lfuqueue_slot {
+	int state;
+	struct info inf;
+};
+
+/*
+ * The indices are written by every enqueuer and dequeuer of
+ * the block, so each gets a cache line of its own.
+ */
+struct lfuqueue_block {
+	int enq;
+	char pad1[64 - sizeof(int)];
+	int deq;
+	char pad2[64 - sizeof(int)];
+	struct lfuqueue_block *next;
+	struct lfuqueue_slot slots[LFUQUEUE_BLOCK];
+};
+
+struct lfuqueue {
+	struct lfuqueue_block *Head;
+	char pad[64 - sizeof(void *)];
+	struct lfuqueue_block *Tail;
+	struct lfuqueue_block *First; /* every block, for destroy */
+};
+
+/* Initialization of an unrolled lock free queue */
+void initlfuqueue(struct lfuqueue *);
+
+/* Free every block of the queue, single threaded */
+void destroylfuqueue(struct lfuqueue *);
+
+/* Enqueue a value into an unrolled lock free queue */
+void lfuenqueue(struct lfuqueue *, int, int);
+
+/*
+ * Dequeue a value from an unrolled lock free queue into the
+ * given struct. Return 1 if the queue was not empty, 0
+ * otherwise.
+ */
+int lfudequeue(struct lfuqueue *, struct info *);
+
+#endif /* CONLFUQUEUE_H */
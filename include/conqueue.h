@@ -2,11 +2,14 @@
  * Author: Giannis Giakoumakis
  * Contact: giannis.m.giakoumakis@gmail.com
  *
- * A concurrent unbounded total queue using locks.
+ * A concurrent total queue using locks.
  * There is always a sentinel node in this queue,
  * which value is meaningless.
  * Initially both the head and the tail point to the
  * sentinel node.
+ * The queue is unbounded, unless it is given a capacity
+ * with setcapacity(&q->bound, ...) before it is shared
+ * (see bound.h).
  */
 
 #ifndef CONQUEUE_H
@@ -14,13 +17,22 @@
 
 #include <pthread.h>
 
+#include "bound.h"
 #include "common_structs.h"
+#include "lock.h"
 
+/*
+ * The dequeue side and the enqueue side sit on cache lines of
+ * their own, so that enqueuers and dequeuers do not share one.
+ */
 struct queue {
-	struct queue_node *Head;
-	struct queue_node *Tail;
-	pthread_mutex_t head_lock;
-	pthread_mutex_t tail_lock;
+	struct queue_node *Head __attribute__((aligned(64)));
+	struct lock head_lock;
+	long dequeued;	/* nodes ever dequeued, under head_lock */
+	struct queue_node *Tail __attribute__((aligned(64)));
+	struct lock tail_lock;
+	long enqueued;	/* nodes ever enqueued, under tail_lock */
+	struct bound bound __attribute__((aligned(64)));
 };
 
 struct queue_node {
@@ -42,9 +54,38 @@ struct consumer_attr {
 /* Initialization of a queue */
 void initqueue(struct queue *);
 
-/* Enqueue a new node into a queue */
+/*
+ * Initialization of a queue using a caller allocated
+ * sentinel node.
+ */
+void initqueue_node(struct queue *, struct queue_node *);
+
+/*
+ * Enqueue a new node into a queue, waiting for space
+ * if the queue is full
+ */
 void enqueue(struct queue *, int, int);
 
+/*
+ * Enqueue a caller allocated node, whose value is already
+ * set, into a queue, waiting for space if the queue is full.
+ * The queue owns the node afterwards.
+ */
+void enqueue_node(struct queue *, struct queue_node *);
+
+/*
+ * Enqueue a new node into a queue if it is not full.
+ * Return 1 on success, 0 if the queue is full.
+ */
+int try_enqueue(struct queue *, int, int);
+
+/*
+ * Same as enqueue_node() if the queue is not full. Return 1
+ * on success, 0 if the queue is full (the caller keeps the
+ * node).
+ */
+int try_enqueue_node(struct queue *, struct queue_node *);
+
 /*
  * Delete a node from a queue.
  * Return the value of the deleted node if
@@ -52,4 +93,31 @@ void enqueue(struct queue *, int, int);
  */
 struct info * dequeue(struct queue *);
 
+/*
+ * Delete a node from a queue without copying it out.
+ * Return a node that is no longer part of the queue and
+ * holds the deleted value if the queue is not empty, NULL
+ * otherwise. The caller owns the returned node, which is
+ * one of the nodes previously passed to initqueue_node()
+ * or enqueue_node() (not necessarily the one the value was
+ * enqueued with, since the sentinel moves forward).
+ */
+struct queue_node * dequeue_node(struct queue *);
+
+/*
+ * Number of values in a queue, taking both locks so that
+ * nothing is enqueued or dequeued meanwhile. It stalls both
+ * sides, use queue_size_approx() while the queue is busy.
+ */
+long queue_size(struct queue *);
+
+/*
+ * Number of values in a queue, without locking. It may miss
+ * operations in progress.
+ */
+long queue_size_approx(struct queue *);
+
+/* Return 1 if a queue is empty, 0 otherwise */
+int queue_is_empty(struct queue *);
+
 #endif /* CONQUEUE_H */
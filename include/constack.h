@@ -0,0 +1,100 @@
+/*
+ * Author: Giannis Giakoumakis
+ * Contact: giannis.m.giakoumakis@gmail.com
+ *
+ * A concurrent lock free stack (Treiber's), with an
+ * elimination array: a push or pop whose CAS on the top
+ * fails tries a random slot of the array instead, where a
+ * waiting push hands its node straight to a pop and neither
+ * touches the top again.
+ *
+ * The top and the slots are tagged pointers, the upper 16
+ * bits of the word count the changes made to it, so a CAS
+ * fails when the word left and came back to the same node
+ * (ABA). This relies on user space addresses fitting in 48
+ * bits, as they do on x86-64 and AArch64.
+ *
+ * Stack nodes are queue nodes, so a tree node can travel
+ * through a stack (see push_node()/pop_node()) as it does
+ * through a struct queue, and a stack makes a free list of
+ * queue or tree nodes. A popped node may still be read by
+ * a concurrent pop, so it can be reused but not freed while
+ * the stack is in use. pop() keeps its nodes for reuse by
+ * push() for that reason, in a short free list the stack
+ * holds for the calling thread, which needs no atomic
+ * operation. A thread that pops more than it pushes hands its
+ * list over, STACK_CACHE nodes at a time, to an overflow list
+ * of the stack, which a thread that runs out takes whole.
+ * Only destroystack() frees them.
+ */
+
+#ifndef CONSTACK_H
+#define CONSTACK_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "common_structs.h"
+#include "conqueue.h"
+
+/* Slots of the elimination array */
+#define STACK_ELIM 8
+
+/* Iterations a push waits in a slot for a pop */
+#define STACK_ELIM_SPINS 256
+
+/* Nodes a thread keeps for reuse */
+#define STACK_CACHE 64
+
+struct stack_slot {
+	uint64_t word;
+	char pad[64 - sizeof(uint64_t)];
+};
+
+/* The nodes of pop() one thread keeps for its push() */
+struct nodecache {
+	pthread_t owner;
+	struct queue_node *head;
+	struct queue_node *tail;
+	int n;
+	struct nodecache *next;
+} __attribute__((aligned(64)));
+
+struct lfstack {
+	uint64_t top;
+	char pad1[64 - sizeof(uint64_t)];
+	struct queue_node *overflow; /* nodes of pop(), reused by push() */
+	char pad2[64 - sizeof(struct queue_node *)];
+	struct nodecache *caches; /* of every thread that used the stack */
+	uint64_t id;
+	struct stack_slot elim[STACK_ELIM];
+};
+
+/* Initialization of a lock free stack */
+void initstack(struct lfstack *);
+
+/*
+ * Free every node of a stack, including the ones kept for
+ * reuse by any thread, single threaded
+ */
+void destroystack(struct lfstack *);
+
+/* Push a new node holding the given value */
+void push(struct lfstack *, int, int);
+
+/*
+ * Pop the top value into the given struct. Return 1 if the
+ * stack was not empty, 0 otherwise.
+ */
+int pop(struct lfstack *, struct info *);
+
+/* Push a node of the caller, whose next field is overwritten */
+void push_node(struct lfstack *, struct queue_node *);
+
+/*
+ * Pop the top node, NULL if the stack is empty. The node
+ * must not be freed while other threads use the stack.
+ */
+struct queue_node * pop_node(struct lfstack *);
+
+#endif /* CONSTACK_H */
@@ -0,0 +1,57 @@
+/*
+ * Author: Giannis Giakoumakis
+ * Contact: giannis.m.giakoumakis@gmail.com
+ *
+ * A concurrent unbounded total queue using locks, whose
+ * nodes (blocks) hold UQUEUE_BLOCK items each. Like the
+ * two-lock queue, enqueuers only take the tail lock and
+ * dequeuers the head lock, so both ends work at once even
+ * inside the same block: an enqueuer fills a slot and then
+ * raises its ready flag, and a dequeuer takes a slot only
+ * once its flag is up. A block is allocated once every
+ * UQUEUE_BLOCK enqueues and freed once every UQUEUE_BLOCK
+ * dequeues.
+ */
+
+#ifndef CONUQUEUE_H
+#define CONUQUEUE_H
+
+#include <pthread.h>
+
+#include "common_structs.h"
+#include "lock.h"
+
+/* Items per block, a block takes a little under five cache lines */
+#define UQUEUE_BLOCK 32
+
+struct uqueue_block {
+	struct info items[UQUEUE_BLOCK];
+	char ready[UQUEUE_BLOCK];
+	struct uqueue_block *next;
+};
+
+struct uqueue {
+	struct uqueue_block *Head;
+	int head_slot;		/* next slot to dequeue, under head_lock */
+	struct lock head_lock;
+	struct uqueue_block *Tail;
+	int tail_slot;		/* next slot to enqueue, under tail_lock */
+	struct lock tail_lock;
+};
+
+/* Initialization of an unrolled queue */
+void inituqueue(struct uqueue *);
+
+/* Free every block of an unrolled queue, single threaded */
+void destroyuqueue(struct uqueue *);
+
+/* Enqueue a value into an unrolled queue */
+void uenqueue(struct uqueue *, int, int);
+
+/*
+ * Dequeue a value from an unrolled queue into the given
+ * struct. Return 1 if the queue was not empty, 0 otherwise.
+ */
+int udequeue(struct uqueue *, struct info *);
+
+#endif /* CONUQUEUE_H */
@@ -0,0 +1,46 @@
+/*
+ * Author: Giannis Giakoumakis
+ * Contact: giannis.m.giakoumakis@gmail.com
+ *
+ * A counter split into cache line sized shards. Threads are
+ * spread over the shards round robin, so as long as there
+ * are no more threads than shards every thread updates a
+ * line of its own. Reading the counter adds the shards up,
+ * which is exact only if nobody updates it meanwhile.
+ */
+
+#ifndef COUNTER_H
+#define COUNTER_H
+
+#define COUNTER_SHARDS 32
+
+struct counter_shard {
+	long n;
+	char pad[64 - sizeof(long)];
+};
+
+struct counter {
+	struct counter_shard shard[COUNTER_SHARDS];
+} __attribute__((aligned(64)));
+
+/* Shard of the calling thread, -1 until its first update */
+extern __thread int myshard;
+
+/* Zero every shard */
+void initcounter(struct counter *);
+
+/* Pick the shard of the calling thread */
+void counter_register(void);
+
+/* Sum of the shards */
+long counter_read(struct counter *);
+
+static inline void
+counter_add(struct counter *c, long n)
+{
+	if (__builtin_expect(myshard < 0, 0))
+		counter_register();
+	__atomic_fetch_add(&c->shard[myshard].n, n, __ATOMIC_RELAXED);
+}
+
+#endif /* COUNTER_H */
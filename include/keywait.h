@@ -0,0 +1,70 @@
+/*
+ * Author: Giannis Giakoumakis
+ * Contact: giannis.m.giakoumakis@gmail.com
+ *
+ * Threads waiting for a key to show up in a data structure,
+ * parked on futexes. Keys hash, together with the address of
+ * their structure, to a fixed table of buckets, each a
+ * sequence number to sleep on and a count of the threads
+ * sleeping there. Whoever publishes a key bumps the sequence
+ * of its bucket and wakes it up, waking the waiters of the
+ * other keys of the bucket too, which simply look again.
+ *
+ * A waiter registers (keywait_begin()) before it looks for
+ * the key, and a publisher looks for waiters (keywait_wake())
+ * after the key is visible, so either the waiter finds the
+ * key or its sleep is cut short by the new sequence.
+ */
+
+#ifndef KEYWAIT_H
+#define KEYWAIT_H
+
+#include <stdint.h>
+
+/* Buckets of the table */
+#define KEYWAIT_BITS 10
+#define KEYWAIT_BUCKETS (1 << KEYWAIT_BITS)
+
+struct keywait_bucket {
+	int seq;
+	int waiters;
+	char pad[64 - 2 * sizeof(int)];
+};
+
+/* A registered waiter */
+struct keywait {
+	struct keywait_bucket *b;
+	int seq;		/* of the bucket before the last look */
+};
+
+/* Waiters in the whole table, so publishers can skip hashing */
+extern int keywaiters;
+
+/* Register for a key of a structure, before looking for it */
+void keywait_begin(struct keywait *, const void *, int);
+
+/*
+ * Sleep until the bucket is woken up or the deadline (of
+ * now_ns(), 0 for none) passes, then read the sequence again
+ * before the next look. Return 0 if the deadline passed, 1
+ * otherwise.
+ */
+int keywait_sleep(struct keywait *, uint64_t);
+
+/* Unregister */
+void keywait_end(struct keywait *);
+
+/* Slow path of keywait_wake() */
+void keywait_wakeup(const void *, int);
+
+/* Wake the waiters of a key that was just published */
+static inline void
+keywait_wake(const void *obj, int key)
+{
+	/* the key must be visible before we look for waiters */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&keywaiters, __ATOMIC_ACQUIRE) > 0)
+		keywait_wakeup(obj, key);
+}
+
+#endif /* KEYWAIT_H */
@@ -0,0 +1,255 @@
+/*
+ * Author: Giannis Giakoumakis
+ * Contact: giannis.m.giakoumakis@gmail.com
+ *
+ * The lock of the two-lock queue (conqueue.c) and of the
+ * fine grain locking BST (conbst.c), chosen at compile time
+ * with LOCK=<kind> in the Makefile (-D_LOCK_<KIND>):
+ *
+ *	mutex		pthread_mutex_t, the default
+ *	ticket		FIFO spin lock, two counters
+ *	mcs		queue lock, waiters spin on their own node
+ *	clh		queue lock, waiters spin on their predecessor
+ *	adaptive	spins for a while, then parks on a futex
+ *
+ * Every kind is released by the thread that acquired it.
+ * The queue locks take their queue nodes from a per-thread
+ * pool, so a thread may hold any number of them at once, as
+ * hand over hand locking and traversal need. The spin locks
+ * yield the CPU after spinning for a while, so that
+ * oversubscribed runs still make progress.
+ */
+
+#ifndef LOCK_H
+#define LOCK_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+
+/* Spins before a spin lock yields, or the adaptive one parks */
+#define LOCK_SPINS 1024
+
+static inline void
+cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+static inline void
+spin_wait(unsigned int *spins)
+{
+	if (++*spins < LOCK_SPINS)
+		cpu_relax();
+	else {
+		*spins = 0;
+		sched_yield();
+	}
+}
+
+#if defined(_LOCK_TICKET)
+
+#define LOCK_NAME "ticket"
+
+struct lock {
+	unsigned int next;	/* ticket of the next arrival */
+	unsigned int owner;	/* ticket being served */
+};
+
+#elif defined(_LOCK_MCS) || defined(_LOCK_CLH)
+
+#ifdef _LOCK_MCS
+#define LOCK_NAME "mcs"
+#else
+#define LOCK_NAME "clh"
+#endif
+
+/* Free queue nodes a thread keeps, the rest are freed */
+#define LOCK_POOL_MAX 64
+
+struct lock_qnode {
+	struct lock_qnode *next; /* successor (MCS), free list */
+	int locked;
+} __attribute__((aligned(64)));
+
+struct lock {
+	struct lock_qnode *tail; /* NULL if the lock is free */
+	struct lock_qnode *holder; /* node of the holder */
+};
+
+/* A queue node from the pool of the calling thread */
+struct lock_qnode * lock_qnode_get(void);
+
+/* Give a queue node no other thread can see to the pool */
+void lock_qnode_put(struct lock_qnode *);
+
+#elif defined(_LOCK_ADAPTIVE)
+
+#define LOCK_NAME "adaptive"
+
+struct lock {
+	int state; /* 0 free, 1 held, 2 held with parked waiters */
+	int spins; /* running estimate of the spins that pay off */
+};
+
+void lock_park(struct lock *);
+void lock_unpark(struct lock *);
+
+#else /* mutex */
+
+#define LOCK_NAME "mutex"
+
+struct lock {
+	pthread_mutex_t m;
+};
+
+#endif
+
+/* Initialization of a free lock, exits on failure */
+void initlock(struct lock *);
+
+void destroylock(struct lock *);
+
+/* Acquire a lock, return 1 if it was free, 0 otherwise */
+int lock_try(struct lock *);
+
+#if defined(_LOCK_TICKET)
+
+static inline void
+lock_acquire(struct lock *l)
+{
+	unsigned int me, spins = 0;
+
+	me = __atomic_fetch_add(&l->next, 1, __ATOMIC_RELAXED);
+	while (__atomic_load_n(&l->owner, __ATOMIC_ACQUIRE) != me)
+		spin_wait(&spins);
+}
+
+static inline void
+lock_release(struct lock *l)
+{
+	__atomic_store_n(&l->owner, l->owner + 1, __ATOMIC_RELEASE);
+}
+
+#elif defined(_LOCK_MCS)
+
+static inline void
+lock_acquire(struct lock *l)
+{
+	struct lock_qnode *n, *pred;
+	unsigned int spins = 0;
+
+	n = lock_qnode_get();
+	n->next = NULL;
+	n->locked = 1;
+	pred = __atomic_exchange_n(&l->tail, n, __ATOMIC_ACQ_REL);
+	if (pred != NULL) {
+		__atomic_store_n(&pred->next, n, __ATOMIC_RELEASE);
+		while (__atomic_load_n(&n->locked, __ATOMIC_ACQUIRE))
+			spin_wait(&spins);
+	}
+	l->holder = n;
+}
+
+static inline void
+lock_release(struct lock *l)
+{
+	struct lock_qnode *n, *next, *expected;
+	unsigned int spins = 0;
+
+	n = l->holder;
+	next = __atomic_load_n(&n->next, __ATOMIC_ACQUIRE);
+	if (next == NULL) {
+		expected = n;
+		if (__atomic_compare_exchange_n(&l->tail, &expected, NULL,
+		    0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+			lock_qnode_put(n);
+			return;
+		}
+		/* a successor is linking itself in */
+		while ((next = __atomic_load_n(&n->next,
+		    __ATOMIC_ACQUIRE)) == NULL)
+			spin_wait(&spins);
+	}
+	__atomic_store_n(&next->locked, 0, __ATOMIC_RELEASE);
+	lock_qnode_put(n);
+}
+
+#elif defined(_LOCK_CLH)
+
+/*
+ * A successor owns the node of its predecessor once it saw
+ * it unlocked, so a node is recycled either by its successor
+ * or, without one, by the thread that released it.
+ */
+static inline void
+lock_acquire(struct lock *l)
+{
+	struct lock_qnode *n, *pred;
+	unsigned int spins = 0;
+
+	n = lock_qnode_get();
+	n->locked = 1;
+	pred = __atomic_exchange_n(&l->tail, n, __ATOMIC_ACQ_REL);
+	if (pred != NULL) {
+		while (__atomic_load_n(&pred->locked, __ATOMIC_ACQUIRE))
+			spin_wait(&spins);
+		lock_qnode_put(pred);
+	}
+	l->holder = n;
+}
+
+static inline void
+lock_release(struct lock *l)
+{
+	struct lock_qnode *n, *expected;
+
+	n = l->holder;
+	expected = n;
+	if (__atomic_compare_exchange_n(&l->tail, &expected, NULL, 0,
+	    __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		lock_qnode_put(n);
+	else
+		__atomic_store_n(&n->locked, 0, __ATOMIC_RELEASE);
+}
+
+#elif defined(_LOCK_ADAPTIVE)
+
+static inline void
+lock_acquire(struct lock *l)
+{
+	int free = 0;
+
+	if (!__atomic_compare_exchange_n(&l->state, &free, 1, 0,
+	    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		lock_park(l);
+}
+
+static inline void
+lock_release(struct lock *l)
+{
+	if (__atomic_exchange_n(&l->state, 0, __ATOMIC_RELEASE) == 2)
+		lock_unpark(l);
+}
+
+#else /* mutex */
+
+static inline void
+lock_acquire(struct lock *l)
+{
+	pthread_mutex_lock(&l->m);
+}
+
+static inline void
+lock_release(struct lock *l)
+{
+	pthread_mutex_unlock(&l->m);
+}
+
+#endif
+
+#endif /* LOCK_H */
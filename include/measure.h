@@ -0,0 +1,78 @@
+/*
+ * Author: Giannis Giakoumakis
+ * Contact: giannis.m.giakoumakis@gmail.com
+ *
+ * Time keeping and latency bookkeeping used by the
+ * benchmark drivers.
+ */
+
+#ifndef MEASURE_H
+#define MEASURE_H
+
+#include <stdint.h>
+
+/*
+ * Log-linear latency histogram (in nanoseconds), in the
+ * style of HdrHistogram. Values below LATENCY_SUB are
+ * counted exactly; above that every power of two is split
+ * into LATENCY_SUB / 2 equal buckets, so any value is
+ * recorded with a relative error below 2 / LATENCY_SUB.
+ * A histogram belongs to one thread and is updated without
+ * locks or atomics; histograms of several threads are
+ * merged after the threads are joined.
+ */
+#define LATENCY_SUB_BITS 7
+#define LATENCY_SUB (1 << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS \
+	(LATENCY_SUB + (64 - LATENCY_SUB_BITS) * (LATENCY_SUB / 2))
+
+struct latency {
+	uint64_t *counts; /* LATENCY_BUCKETS counters */
+	uint64_t n;
+	uint64_t max;
+};
+
+/* Monotonic time in nanoseconds */
+uint64_t now_ns(void);
+
+/* Initialization of an empty histogram */
+void initlatency(struct latency *);
+
+/* Index of the bucket a value falls into */
+static inline int
+latency_bucket(uint64_t v)
+{
+	int shift;
+
+	if (v < LATENCY_SUB)
+		return (int)v;
+	/* keep the LATENCY_SUB_BITS - 1 bits below the top one */
+	shift = 63 - __builtin_clzll(v) - (LATENCY_SUB_BITS - 1);
+	return LATENCY_SUB + (shift - 1) * (LATENCY_SUB / 2) +
+	    (int)((v >> shift) - LATENCY_SUB / 2);
+}
+
+/* Record one value, cheap enough for the measured loops */
+static inline void
+latency_add(struct latency *l, uint64_t ns)
+{
+	l->counts[latency_bucket(ns)]++;
+	l->n++;
+	if (ns > l->max)
+		l->max = ns;
+}
+
+/* Add every value of the second histogram to the first one */
+void latency_merge(struct latency *, struct latency *);
+
+/*
+ * Return the p-th percentile (0 < p <= 100) of a histogram,
+ * i.e. the largest value of the bucket holding the nearest
+ * rank, 0 if the histogram is empty.
+ */
+uint64_t latency_percentile(struct latency *, double);
+
+/* Release the memory held by a histogram */
+void latency_free(struct latency *);
+
+#endif /* MEASURE_H */
@@ -0,0 +1,111 @@
+/*
+ * Author: Giannis Giakoumakis
+ * Contact: giannis.m.giakoumakis@gmail.com
+ *
+ * Allocation of queue and tree nodes. Allocations and
+ * frees are counted per NUMA node, so that memory crossing
+ * sockets (a producer on one socket feeding a consumer on
+ * another) shows up in the statistics.
+ *
+ * Placement relies on the first touch policy of the kernel
+ * only, no memory is bound with mbind() or set_mempolicy().
+ * A node on a page the allocating thread touches first lands
+ * on its NUMA node, but a node reused from memory touched or
+ * freed elsewhere (a recycled malloc() chunk, a batch of the
+ * arena freed on another socket) stays where it is. Check
+ * with address_node() when placement matters.
+ *
+ * Nodes come from malloc() by default. The arena allocator
+ * carves them instead out of 2 MiB chunks mapped with huge
+ * pages (MAP_HUGETLB, or transparent huge pages when none
+ * are reserved), so a walk over many nodes needs a fraction
+ * of the TLB entries. Every chunk holds nodes of one size
+ * class, which a thread bumps through on its own, and freed
+ * nodes go to a free list of the freeing thread, passed on
+ * in batches to the others. Chunks are never unmapped one
+ * by one but all at once, by nodealloc_release().
+ */
+
+#ifndef NODEALLOC_H
+#define NODEALLOC_H
+
+#include <stddef.h>
+
+/* NUMA nodes tracked, higher node numbers share the last entry */
+#define NODEALLOC_MAXNODES 16
+
+/* Largest node the arena allocator serves */
+#define NODEALLOC_ARENA_MAX 2048
+
+enum nodealloc_kind {
+	NODEALLOC_MALLOC,
+	NODEALLOC_ARENA
+};
+
+/* Pages backing the chunks of the arena allocator */
+struct arenastats {
+	long huge; /* MAP_HUGETLB */
+	long transparent; /* transparent huge pages asked for */
+	long small; /* neither, normal pages */
+};
+
+struct nodestats {
+	long allocs; /* nodes allocated by threads running on the node */
+	long frees; /* nodes freed by threads running on the node */
+};
+
+/*
+ * Return a node of the given size, on the NUMA node of the
+ * calling thread as far as first touch places it (see above).
+ * Exits on failure.
+ */
+void * node_alloc(size_t);
+
+/* Release a node returned by node_alloc() */
+void node_free(void *);
+
+/*
+ * Pick the allocator of node_alloc()/node_free(). Only while
+ * no node is allocated, i.e. before any data structure is
+ * made.
+ */
+void nodealloc_use(enum nodealloc_kind);
+
+/* Name of the allocator in use, "malloc" or "arena" */
+const char * nodealloc_name(void);
+
+/*
+ * Unmap every chunk of the arena allocator at once, along
+ * with the nodes threads kept on their free lists. No node
+ * may be in use anymore. Does nothing under malloc.
+ */
+void nodealloc_release(void);
+
+/* Chunks of the arena allocator mapped since the last release */
+void nodealloc_arena_stats(struct arenastats *);
+
+/* Number of NUMA nodes of the machine (1 without NUMA) */
+int numa_nodes(void);
+
+/* NUMA node of a CPU, 0 if unknown */
+int cpu_node(int);
+
+/* NUMA node the calling thread currently runs on */
+int current_node(void);
+
+/*
+ * NUMA node holding the memory at the given address, -1
+ * if unknown (not touched yet, or no NUMA support).
+ */
+int address_node(const void *);
+
+/* Counters of a NUMA node since the last reset */
+void nodealloc_stats(int, struct nodestats *);
+
+/*
+ * Zero the counters of every NUMA node, while no other thread
+ * allocates or frees nodes
+ */
+void nodealloc_reset(void);
+
+#endif /* NODEALLOC_H */
@@ -0,0 +1,64 @@
+/*
+ * Author: Giannis Giakoumakis
+ * Contact: giannis.m.giakoumakis@gmail.com
+ *
+ * Hardware and software event counters of the calling
+ * thread, through perf_event_open(2). Counters the kernel or
+ * the machine does not provide (virtual machines, a strict
+ * perf_event_paranoid, containers) are simply reported as
+ * unavailable.
+ */
+
+#ifndef PERFCOUNT_H
+#define PERFCOUNT_H
+
+#include <stdint.h>
+
+enum perfevent {
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_LLC_MISSES,
+	PERF_BRANCH_MISSES,
+	PERF_CTX_SWITCHES,
+	PERF_DTLB_MISSES,
+	NPERFEVENTS
+};
+
+extern const char *perfnames[NPERFEVENTS];
+
+/* Counters opened by one thread */
+struct perfcounters {
+	int fd[NPERFEVENTS]; /* -1 if unavailable */
+};
+
+/*
+ * Counter values. Bit i of avail tells whether v[i] was
+ * counted.
+ */
+struct perfsample {
+	uint64_t v[NPERFEVENTS];
+	unsigned int avail;
+};
+
+/* Open every counter available to the calling thread */
+void perf_open(struct perfcounters *);
+
+/* Read the counters of the calling thread */
+void perf_read(struct perfcounters *, struct perfsample *);
+
+void perf_close(struct perfcounters *);
+
+/* d = b - a, what was counted between two reads */
+void perf_diff(struct perfsample *, struct perfsample *,
+    struct perfsample *);
+
+/*
+ * Add src to dst. A counter stays available only if it was
+ * available in both, so totals never leave out a thread.
+ */
+void perf_add(struct perfsample *, struct perfsample *);
+
+/* An empty sum, to be filled with perf_add() */
+void perf_zero(struct perfsample *);
+
+#endif /* PERFCOUNT_H */
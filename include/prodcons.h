@@ -7,42 +7,152 @@
 #define PRODCONS_H
 
 #include <pthread.h>
+#include <stdint.h>
 
-#if defined _LOCK_FREE_QUEUE
-#include "conlfqueue.h"
-#else
-#include "conqueue.h"
-#endif
-
-#include "conbst.h"
+#include "affinity.h"
+#include "backend.h"
+#include "measure.h"
+#include "nodealloc.h"
+#include "perfcount.h"
 #include "pthread_barrier.h"
+#include "stats.h"
+#include "trace.h"
+
+/* Output formats of the results */
+enum format {
+	FORMAT_HUMAN,
+	FORMAT_CSV,
+	FORMAT_JSON
+};
+
+/*
+ * Which consumers take the items of which producers. With a
+ * mapping every item has a consumer assigned when it is made;
+ * with MAPPING_ANY consumers take whatever item is smallest.
+ */
+enum mapping {
+	MAPPING_AUTO,		/* chosen from the thread counts */
+	MAPPING_ONE_TO_ONE,	/* producer i to consumer i */
+	MAPPING_FAN_IN,		/* producer i to consumer i % nconsumers */
+	MAPPING_FAN_OUT,	/* producer i to consumers i, i + P, ... */
+	MAPPING_ANY		/* any producer to any consumer */
+};
+
+extern const char *mappingnames[];
+
+/* Benchmark parameters given on the command line */
+struct config {
+	int nproducers;
+	int nconsumers;
+	int nitems; /* items per producer, unused if duration > 0 */
+	double duration; /* seconds of production, 0 to use nitems */
+	int warmup; /* runs whose results are discarded */
+	int repetitions; /* runs whose results are reported */
+	enum format format;
+	enum mapping mapping;
+	/*
+	 * Streaming runs have producers, announcers and consumers
+	 * all working at once, with at most inflight items made
+	 * but not consumed yet. Otherwise the producers announce
+	 * their items themselves, once every item is made.
+	 */
+	int stream;
+	int nannouncers; /* nproducers unless streaming */
+	int inflight;
+	int capacity; /* of the queue, 0 for none */
+	const struct queue_ops *qops;
+	const struct map_ops *mops;
+	/*
+	 * CPUs of the threads, producer i is thread i, consumer i
+	 * is thread nproducers + i and announcer i of a streaming
+	 * run is thread nproducers + nconsumers + i
+	 */
+	struct affinity affinity;
+	/* file the first reported run is recorded to, or NULL */
+	const char *tracefile;
+	/* dispatch overhead of qops and mops, in ns per operation */
+	double qdispatch;
+	double mdispatch;
+};
+
+/* Operations whose latency is measured */
+enum op {
+	OP_ENQUEUE,
+	OP_DEQUEUE,
+	OP_INSERT,
+	OP_DELETE,
+	OP_ENDTOEND,	/* enqueue to consumption, streaming only */
+	NOPS
+};
+
+/* What a thread measured during one phase of a run */
+struct phasestats {
+	uint64_t start;
+	uint64_t end;
+	long ops;
+	struct perfsample perf; /* events counted by the thread */
+};
+
+/* State shared by every thread of a run */
+struct runinfo {
+	struct config *cfg;
+	pthread_barrier_t start;
+	pthread_barrier_t barrier;
+	void *queue;
+	void *tree;
+	/*
+	 * Whether items move from the queue into the tree as
+	 * tree nodes, or get copied because one of the two
+	 * cannot take nodes.
+	 */
+	int transplant;
+	/*
+	 * Number of items assigned to each consumer, final once
+	 * the production phase is over. Consumer c takes the
+	 * timestamps seq * nconsumers + c, for seq < assigned[c].
+	 */
+	int *assigned;
+	/* producers done producing, ends streaming announcers */
+	int produced;
+	/* threads done announcing, ends MAPPING_ANY consumers */
+	int done;
+	/* items made but not consumed yet, when streaming */
+	int inflight;
+	/*
+	 * When streaming, the time each item was enqueued at, 0
+	 * if the slot is free: a ring of bornmask + 1 slots per
+	 * timestamp sequence, see bornslot() in prodcons.c.
+	 */
+	uint64_t *born;
+	int bornmask;
+	/*
+	 * Operations of thread i (numbered like the affinity
+	 * policy) go to trace[i], NULL if the run is not recorded.
+	 */
+	struct tracebuf *trace;
+};
 
 struct producerinfo {
-	pthread_t *tid;
-	int nthreads;
-	pthread_barrier_t *barrier;
-#if defined _LOCK_FREE_QUEUE
-	struct lfqueue *queue;
-#else
-	struct queue *queue;
-#endif
-	struct tree *tree;
+	int id;
+	struct runinfo *run;
+	struct phasestats production;
+	struct phasestats announcement;
+	struct latency lat[NOPS];
 };
 
 struct consumerinfo {
-	pthread_t *tid;
-	int nthreads;
-	pthread_barrier_t *barrier;
-
-	struct tree *tree;
+	int id;
+	struct runinfo *run;
+	struct phasestats consumption;
+	struct latency lat[NOPS];
 };
 
 void usage(int);
 
 void * produce(void *);
 
-void * consume(void *);
+void * announce(void *);
 
-int modulo(int, int);
+void * consume(void *);
 
 #endif /* PRODCONS_H */
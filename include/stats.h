@@ -0,0 +1,129 @@
+/*
+ * Author: Giannis Giakoumakis
+ * Contact: giannis.m.giakoumakis@gmail.com
+ *
+ * Contention statistics of the queues and the tree, compiled
+ * in with -D_STATS. Every thread counts into a cache line
+ * aligned block of its own, and stats_dump() adds the blocks
+ * up. Without _STATS the STAT_* macros expand to nothing (or
+ * to the plain lock call) and stats_dump() prints nothing.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "lock.h"
+
+enum stat {
+	STAT_CAS,		/* CAS attempts of the lock free structures */
+	STAT_CAS_FAILED,
+	STAT_EMPTY,		/* dequeues that found the queue empty */
+	STAT_ELIMINATED,	/* pushes that met a pop in constack.c */
+	STAT_HEAD_LOCKS,	/* head_lock acquisitions in conqueue.c */
+	STAT_HEAD_CONTENDED,	/* ... that had to wait */
+	STAT_HEAD_WAIT_NS,	/* ... and for how long */
+	STAT_TAIL_LOCKS,
+	STAT_TAIL_CONTENDED,
+	STAT_TAIL_WAIT_NS,
+	STAT_INSERTS,		/* insert_node() calls in conbst.c */
+	STAT_INSERT_LOCKED,	/* nodes locked by them */
+	STAT_DELETES,		/* delete_node() calls */
+	STAT_DELETE_LOCKED,
+	STAT_FINDHELPERS,	/* findhelper() calls */
+	STAT_FINDHELPER_LOCKED,
+	STAT_DEPTH_SUM,		/* depth reached by inserts and deletes */
+	STAT_DEPTH_MAX,
+	NSTATS
+};
+
+/* Print the statistics of every thread so far, added up */
+void stats_dump(FILE *);
+
+/* Zero the statistics, no other thread may be counting */
+void stats_reset(void);
+
+#ifdef _STATS
+
+#include "measure.h"
+
+struct threadstats {
+	uint64_t c[NSTATS];
+	uint64_t depth; /* depth of the current tree operation */
+	struct threadstats *next;
+} __attribute__((aligned(64)));
+
+extern __thread struct threadstats *mystats;
+
+/* Allocate and register the block of the calling thread */
+void stats_register(void);
+
+static inline struct threadstats *
+stats_self(void)
+{
+	if (__builtin_expect(mystats == NULL, 0))
+		stats_register();
+	return mystats;
+}
+
+/* One more node locked on the way down the tree */
+static inline void
+stat_descend(enum stat locked)
+{
+	struct threadstats *ts = stats_self();
+
+	ts->c[locked]++;
+	ts->c[STAT_DEPTH_SUM]++;
+	ts->depth++;
+}
+
+/* The current tree operation is over */
+static inline void
+stat_depth_end(void)
+{
+	struct threadstats *ts = stats_self();
+
+	if (ts->depth > ts->c[STAT_DEPTH_MAX])
+		ts->c[STAT_DEPTH_MAX] = ts->depth;
+	ts->depth = 0;
+}
+
+/*
+ * Lock m, counting the acquisition and, if it was held by
+ * someone else, the time spent waiting for it.
+ */
+static inline void
+stat_lock(struct lock *m, enum stat locks)
+{
+	struct threadstats *ts = stats_self();
+	uint64_t t0;
+
+	ts->c[locks]++;
+	if (lock_try(m))
+		return;
+	t0 = now_ns();
+	lock_acquire(m);
+	ts->c[locks + 1]++;
+	ts->c[locks + 2] += now_ns() - t0;
+}
+
+#define STAT_ADD(s, n)		(stats_self()->c[(s)] += (n))
+/* locks must be STAT_HEAD_LOCKS or STAT_TAIL_LOCKS */
+#define STAT_LOCK(m, locks)	stat_lock((m), (locks))
+/* locked must be STAT_INSERT_LOCKED or STAT_DELETE_LOCKED */
+#define STAT_DESCEND(locked)	stat_descend(locked)
+#define STAT_DEPTH_END()	stat_depth_end()
+
+#else /* !_STATS */
+
+#define STAT_ADD(s, n)		do { } while (0)
+#define STAT_LOCK(m, locks)	lock_acquire(m)
+#define STAT_DESCEND(locked)	do { } while (0)
+#define STAT_DEPTH_END()	do { } while (0)
+
+#endif /* _STATS */
+
+#endif /* STATS_H */
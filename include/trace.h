@@ -0,0 +1,96 @@
+/*
+ * Author: Giannis Giakoumakis
+ * Contact: giannis.m.giakoumakis@gmail.com
+ *
+ * Binary workload traces. A trace holds, per thread, the
+ * operations the thread completed, in order:
+ *
+ *	struct traceheader
+ *	uint64_t count[nthreads]	records of each thread
+ *	struct tracerec[nrecords]	thread 0 first, then 1, ...
+ *
+ * Every field is in host byte order. TRACE_BARRIER records
+ * mark the points where every thread waited for the others.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRACE_MAGIC "CDSTRACE"
+#define TRACE_VERSION 1
+
+enum traceop {
+	TRACE_ENQUEUE,
+	TRACE_DEQUEUE,
+	TRACE_INSERT,
+	TRACE_DELETE,
+	TRACE_BARRIER,
+	NTRACEOPS
+};
+
+struct traceheader {
+	char magic[8];
+	uint32_t version;
+	uint32_t nthreads;
+	uint64_t nrecords;
+};
+
+struct tracerec {
+	int32_t key;
+	uint16_t op;
+	uint16_t tid;
+};
+
+/* Records of one thread, while recording */
+struct tracebuf {
+	struct tracerec *recs;
+	size_t n;
+	size_t size;
+};
+
+void inittracebuf(struct tracebuf *);
+
+void tracebuf_free(struct tracebuf *);
+
+/* Make room for more records, used by trace_add() */
+void grow_tracebuf(struct tracebuf *);
+
+/* Append a record, the buffer belongs to the calling thread */
+static inline void
+trace_add(struct tracebuf *b, int tid, enum traceop op, int key)
+{
+	if (b->n == b->size)
+		grow_tracebuf(b);
+	b->recs[b->n].key = key;
+	b->recs[b->n].op = (uint16_t)op;
+	b->recs[b->n].tid = (uint16_t)tid;
+	b->n++;
+}
+
+/*
+ * Write the buffers of nthreads threads to a file.
+ * Return 0 on success, -1 on error (errno is set).
+ */
+int trace_write(const char *, struct tracebuf *, int);
+
+/* A trace mapped into memory */
+struct trace {
+	void *map;
+	size_t len;
+	int nthreads;
+	const uint64_t *count;
+	const struct tracerec **recs; /* first record of each thread */
+};
+
+/*
+ * Map a trace file. Return 0 on success, -1 if the file
+ * cannot be mapped or is not a valid trace.
+ */
+int trace_map(const char *, struct trace *);
+
+void trace_unmap(struct trace *);
+
+#endif /* TRACE_H */
@@ -0,0 +1,49 @@
+/*
+ * Author: Giannis Giakoumakis
+ * Contact: giannis.m.giakoumakis@gmail.com
+ *
+ * Tree snapshot files. A snapshot holds the values of a BST
+ * in increasing key order, with no pointers, so it can be
+ * mapped anywhere:
+ *
+ *	struct treefileheader
+ *	struct info[nitems]	strictly increasing timestamps
+ *
+ * Every field is in host byte order.
+ */
+
+#ifndef TREEFILE_H
+#define TREEFILE_H
+
+#include <stdint.h>
+
+#include "conbst.h"
+
+#define TREEFILE_MAGIC "CDSTREES"
+#define TREEFILE_VERSION 1
+
+struct treefileheader {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint64_t nitems;
+};
+
+/*
+ * Write a linearizable snapshot of a BST (see snapshot_tree())
+ * to a file. The file is written under a temporary name and
+ * renamed, so a crash never leaves half a snapshot behind.
+ * Return 0 on success, -1 on error (errno is set).
+ */
+int tree_save(struct tree *, const char *);
+
+/*
+ * Map a snapshot file and insert its values into a BST with
+ * insert_bulk(), which links them into an empty tree as one
+ * balanced tree in O(n), under the tree lock alone. Return
+ * the number of values read, -1 if the file cannot be mapped
+ * or is not a valid snapshot (errno is set).
+ */
+long tree_load(struct tree *, const char *);
+
+#endif /* TREEFILE_H */
@@ -0,0 +1,41 @@
+/*
+ * Author: Giannis Giakoumakis
+ * Contact: giannis.m.giakoumakis@gmail.com
+ *
+ * Parallel traversal and destruction of a BST. The top of
+ * the tree is split, in in-order, into disjoint subtrees
+ * and single nodes (pieces), which a fixed number of worker
+ * threads take one at a time. There should be a few pieces
+ * per worker, so a tree that is not balanced still spreads
+ * over the workers, but a degenerate (list like) tree ends
+ * up mostly in one piece.
+ *
+ * No other thread may use the tree meanwhile.
+ */
+
+#ifndef TREEWALK_H
+#define TREEWALK_H
+
+#include "conbst.h"
+
+/* Pieces made per worker */
+#define TREEWALK_PIECES 8
+
+/*
+ * Call a function for every value of a BST, using nthreads
+ * threads (the caller being one of them). The calls happen
+ * concurrently and in no particular order, but each gets the
+ * in-order position of its value (0 for the smallest key),
+ * so the output can be put in order without sorting, e.g.
+ * into an array or at an offset of a file.
+ */
+void tree_walk_parallel(struct tree *, int,
+    void (*)(struct info *, long, void *), void *);
+
+/*
+ * Free every node of a BST using nthreads threads, leaving
+ * it empty, like destroytree().
+ */
+void destroytree_parallel(struct tree *, int);
+
+#endif /* TREEWALK_H */
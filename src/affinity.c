@@ -0,0 +1,222 @@
+/*
+ * Author: Giannis Giakoumakis
+ * Contact: giannis.m.giakoumakis@gmail.com
+ */
+
+#define _GNU_SOURCE
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/affinity.h"
+#include "../include/nodealloc.h"
+
+struct cpuinfo {
+	int cpu;
+	int node;
+	int rank; /* position of the CPU inside its node */
+};
+
+static int
+cmpcompact(const void *a, const void *b)
+{
+	const struct cpuinfo *x = a, *y = b;
+
+	if (x->node != y->node)
+		return x->node - y->node;
+	return x->cpu - y->cpu;
+}
+
+static int
+cmpscatter(const void *a, const void *b)
+{
+	const struct cpuinfo *x = a, *y = b;
+
+	if (x->rank != y->rank)
+		return x->rank - y->rank;
+	return x->node - y->node;
+}
+
+static int *
+xcalloc_cpus(int n)
+{
+	int *p;
+
+	p = calloc(n, sizeof(int));
+	if (p == NULL) {
+		printf("malloc() failed\n");
+		exit(EXIT_FAILURE);
+	}
+	return p;
+}
+
+/* Order the CPUs the process may run on according to the policy */
+static void
+ordercpus(struct affinity *a, cpu_set_t *allowed)
+{
+	struct cpuinfo *ci;
+	int cpu, n, i, j;
+
+	n = CPU_COUNT(allowed);
+	ci = calloc(n, sizeof(struct cpuinfo));
+	if (ci == NULL) {
+		printf("malloc() failed\n");
+		exit(EXIT_FAILURE);
+	}
+	i = 0;
+	for (cpu = 0; cpu < CPU_SETSIZE && i < n; cpu++) {
+		if (!CPU_ISSET(cpu, allowed))
+			continue;
+		ci[i].cpu = cpu;
+		ci[i].node = cpu_node(cpu);
+		i++;
+	}
+
+	qsort(ci, n, sizeof(struct cpuinfo), cmpcompact);
+	if (a->kind == AFFINITY_SCATTER) {
+		for (i = 0; i < n; i++)
+			ci[i].rank = (i > 0 && ci[i].node == ci[i - 1].node) ?
+			    ci[i - 1].rank + 1 : 0;
+		qsort(ci, n, sizeof(struct cpuinfo), cmpscatter);
+	}
+
+	a->cpus = xcalloc_cpus(n);
+	a->ncpus = n;
+	for (j = 0; j < n; j++)
+		a->cpus[j] = ci[j].cpu;
+	free(ci);
+}
+
+/* Parse a list like "0,2,8-11" into a->cpus */
+static int
+parselist(struct affinity *a, const char *s, cpu_set_t *allowed)
+{
+	const char *p;
+	char *end;
+	long lo, hi, c;
+	int n;
+
+	/* an upper bound of the number of CPUs in the list */
+	n = 0;
+	for (p = s; *p != '\0'; p++)
+		if (*p == ',')
+			n++;
+	a->cpus = xcalloc_cpus(CPU_SETSIZE * (n + 1));
+	a->ncpus = 0;
+
+	p = s;
+	while (1) {
+		lo = strtol(p, &end, 10);
+		if (end == p || lo < 0)
+			return -1;
+		hi = lo;
+		if (*end == '-') {
+			p = end + 1;
+			hi = strtol(p, &end, 10);
+			if (end == p || hi < lo)
+				return -1;
+		}
+		for (c = lo; c <= hi; c++) {
+			if (c >= CPU_SETSIZE || !CPU_ISSET(c, allowed))
+				return -1;
+			a->cpus[a->ncpus++] = (int)c;
+		}
+		if (*end == '\0')
+			break;
+		if (*end != ',')
+			return -1;
+		p = end + 1;
+	}
+	return 0;
+}
+
+int
+parse_affinity(struct affinity *a, const char *s)
+{
+	cpu_set_t allowed;
+
+	a->name = s;
+	a->cpus = NULL;
+	a->ncpus = 0;
+	if (strcmp(s, "none") == 0) {
+		a->kind = AFFINITY_NONE;
+		return 0;
+	}
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+		printf("sched_getaffinity() failed\n");
+		exit(EXIT_FAILURE);
+	}
+	if (strcmp(s, "compact") == 0)
+		a->kind = AFFINITY_COMPACT;
+	else if (strcmp(s, "scatter") == 0)
+		a->kind = AFFINITY_SCATTER;
+	else {
+		a->kind = AFFINITY_LIST;
+		if (parselist(a, s, &allowed) != 0) {
+			free_affinity(a);
+			return -1;
+		}
+		return 0;
+	}
+	ordercpus(a, &allowed);
+	return 0;
+}
+
+int
+affinity_cpu(struct affinity *a, int i)
+{
+	if (a->kind == AFFINITY_NONE || a->ncpus == 0)
+		return -1;
+	return a->cpus[i % a->ncpus];
+}
+
+void
+affinity_attr(struct affinity *a, int i, pthread_attr_t *attr)
+{
+	cpu_set_t set;
+	int cpu, e;
+
+	e = pthread_attr_init(attr);
+	if (e != 0) {
+		printf("pthread_attr_init() failed\n");
+		exit(EXIT_FAILURE);
+	}
+	cpu = affinity_cpu(a, i);
+	if (cpu < 0)
+		return;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	e = pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+	if (e != 0) {
+		printf("pthread_attr_setaffinity_np() failed\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+void
+affinity_apply(struct affinity *a, int i)
+{
+	cpu_set_t set;
+	int cpu, e;
+
+	cpu = affinity_cpu(a, i);
+	if (cpu < 0)
+		return;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	e = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (e != 0) {
+		printf("pthread_setaffinity_np() failed\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+void
+free_affinity(struct affinity *a)
+{
+	free(a->cpus);
+	a->cpus = NULL;
+	a->ncpus = 0;
+}
@@ -0,0 +1,823 @@
+/*
+ * Author: Giannis Giakoumakis
+ * Contact: giannis.m.giakoumakis@gmail.com
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/backend.h"
+#include "../include/conbst.h"
+#include "../include/congeneric.h"
+#include "../include/conlfqueue.h"
+#include "../include/conlfuqueue.h"
+#include "../include/conqueue.h"
+#include "../include/constack.h"
+#include "../include/conuqueue.h"
+#include "../include/measure.h"
+#include "../include/nodealloc.h"
+
+DEFINE_QUEUE(infoqueue, struct info)
+DEFINE_TREE(infotree, int, struct info, GENERIC_CMP)
+
+static void *
+xmalloc(size_t size)
+{
+	void *p;
+
+	p = malloc(size);
+	if (p == NULL) {
+		printf("malloc() failed\n");
+		exit(EXIT_FAILURE);
+	}
+	return p;
+}
+
+/* Two-lock queue (conqueue.c) */
+
+static void *
+lockqueue_create(void)
+{
+	struct queue *q;
+
+	/*
+	 * The sentinel is a tree node, so the queue can carry
+	 * tree nodes from the start.
+	 */
+	q = aligned_alloc(64, sizeof(struct queue));
+	if (q == NULL) {
+		printf("malloc() failed\n");
+		exit(EXIT_FAILURE);
+	}
+	initqueue_node(q, &alloctreenode(-1, -1)->qnode);
+	return q;
+}
+
+static void
+lockqueue_bound(void *q, int n)
+{
+	setcapacity(&((struct queue *)q)->bound, n);
+}
+
+static void
+lockqueue_enqueue(void *q, int pid, int ts)
+{
+	enqueue(q, pid, ts);
+}
+
+static int
+lockqueue_dequeue(void *q, struct info *inf)
+{
+	struct queue_node *node;
+
+	node = dequeue_node(q);
+	if (node == NULL)
+		return 0;
+	*inf = node->inf;
+	node_free(node);
+	return 1;
+}
+
+static void
+lockqueue_enqueue_node(void *q, struct tree_node *n)
+{
+	enqueue_node(q, &n->qnode);
+}
+
+static struct tree_node *
+lockqueue_dequeue_node(void *q)
+{
+	return (struct tree_node *)dequeue_node(q);
+}
+
+static long
+lockqueue_size(void *q, int exact)
+{
+	return exact ? queue_size(q) : queue_size_approx(q);
+}
+
+static void
+lockqueue_direct(void *q, int n)
+{
+	struct queue_node *node;
+	int i;
+
+	for (i = 0; i < n; i++)
+		enqueue(q, 0, i);
+	for (i = 0; i < n; i++) {
+		node = dequeue_node(q);
+		node_free(node);
+	}
+}
+
+static void
+lockqueue_destroy(void *arg)
+{
+	struct queue *q = arg;
+	struct queue_node *node;
+
+	while ((node = q->Head) != NULL) {
+		q->Head = node->next;
+		node_free(node);
+	}
+	destroybound(&q->bound);
+	free(q);
+}
+
+const struct queue_ops lockqueue_ops = {
+	"lock",
+	lockqueue_create,
+	lockqueue_bound,
+	lockqueue_enqueue,
+	lockqueue_dequeue,
+	lockqueue_enqueue_node,
+	lockqueue_dequeue_node,
+	lockqueue_size,
+	lockqueue_direct,
+	lockqueue_destroy
+};
+
+/* Lock free queue (conlfqueue.c) */
+
+static void *
+lfqueue_create(void)
+{
+	struct lfqueue *q;
+
+	q = xmalloc(sizeof(struct lfqueue));
+	initlfqueue(q);
+	return q;
+}
+
+static void
+lfqueue_bound(void *q, int n)
+{
+	setcapacity(&((struct lfqueue *)q)->bound, n);
+}
+
+static void
+lfqueue_enqueue(void *q, int pid, int ts)
+{
+	lfenqueue(q, pid, ts);
+}
+
+static int
+lfqueue_dequeue(void *q, struct info *inf)
+{
+	struct info *result;
+
+	result = lfdequeue(q);
+	if (result == NULL)
+		return 0;
+	*inf = *result;
+	free(result);
+	return 1;
+}
+
+static long
+lfqueue_size(void *q, int exact)
+{
+	return exact ? lfsize(q) : lfsize_approx(q);
+}
+
+static void
+lfqueue_direct(void *q, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		lfenqueue(q, 0, i);
+	for (i = 0; i < n; i++)
+		free(lfdequeue(q));
+}
+
+/*
+ * Dequeued nodes are never freed by conlfqueue.c, only the
+ * ones still linked can be.
+ */
+static void
+lfqueue_destroy(void *arg)
+{
+	struct lfqueue *q = arg;
+	struct lfqueue_node *node;
+
+	while ((node = q->Head) != NULL) {
+		q->Head = node->next;
+		node_free(node);
+	}
+	destroybound(&q->bound);
+	free(q);
+}
+
+/*
+ * Nodes of the lock free queue may still be read by other
+ * dequeuers after they leave the queue, so they cannot be
+ * handed out.
+ */
+const struct queue_ops lfqueue_ops = {
+	"lockfree",
+	lfqueue_create,
+	lfqueue_bound,
+	lfqueue_enqueue,
+	lfqueue_dequeue,
+	NULL,
+	NULL,
+	lfqueue_size,
+	lfqueue_direct,
+	lfqueue_destroy
+};
+
+/* Unrolled two-lock queue (conuqueue.c) */
+
+static void *
+uqueue_create(void)
+{
+	struct uqueue *q;
+
+	q = xmalloc(sizeof(struct uqueue));
+	inituqueue(q);
+	return q;
+}
+
+static void
+uqueue_enqueue(void *q, int pid, int ts)
+{
+	uenqueue(q, pid, ts);
+}
+
+static int
+uqueue_dequeue(void *q, struct info *inf)
+{
+	return udequeue(q, inf);
+}
+
+static void
+uqueue_direct(void *q, int n)
+{
+	struct info inf;
+	int i;
+
+	for (i = 0; i < n; i++)
+		uenqueue(q, 0, i);
+	for (i = 0; i < n; i++)
+		udequeue(q, &inf);
+}
+
+static void
+uqueue_destroy(void *q)
+{
+	destroyuqueue(q);
+	free(q);
+}
+
+/* Items are stored in blocks, there are no nodes to hand out */
+const struct queue_ops uqueue_ops = {
+	"unrolled",
+	uqueue_create,
+	NULL,
+	uqueue_enqueue,
+	uqueue_dequeue,
+	NULL,
+	NULL,
+	NULL,
+	uqueue_direct,
+	uqueue_destroy
+};
+
+/* Unrolled lock free queue (conlfuqueue.c) */
+
+static void *
+lfuqueue_create(void)
+{
+	struct lfuqueue *q;
+
+	q = xmalloc(sizeof(struct lfuqueue));
+	initlfuqueue(q);
+	return q;
+}
+
+static void
+lfuqueue_enqueue(void *q, int pid, int ts)
+{
+	lfuenqueue(q, pid, ts);
+}
+
+static int
+lfuqueue_dequeue(void *q, struct info *inf)
+{
+	return lfudequeue(q, inf);
+}
+
+static void
+lfuqueue_direct(void *q, int n)
+{
+	struct info inf;
+	int i;
+
+	for (i = 0; i < n; i++)
+		lfuenqueue(q, 0, i);
+	for (i = 0; i < n; i++)
+		lfudequeue(q, &inf);
+}
+
+static void
+lfuqueue_destroy(void *q)
+{
+	destroylfuqueue(q);
+	free(q);
+}
+
+const struct queue_ops lfuqueue_ops = {
+	"lfunrolled",
+	lfuqueue_create,
+	NULL,
+	lfuqueue_enqueue,
+	lfuqueue_dequeue,
+	NULL,
+	NULL,
+	NULL,
+	lfuqueue_direct,
+	lfuqueue_destroy
+};
+
+/* Lock free stack with elimination (constack.c), LIFO */
+
+static void *
+stack_create(void)
+{
+	struct lfstack *s;
+
+	s = xmalloc(sizeof(struct lfstack));
+	initstack(s);
+	return s;
+}
+
+static void
+stack_enqueue(void *s, int pid, int ts)
+{
+	push(s, pid, ts);
+}
+
+static int
+stack_dequeue(void *s, struct info *inf)
+{
+	return pop(s, inf);
+}
+
+static void
+stack_direct(void *s, int n)
+{
+	struct info inf;
+	int i;
+
+	for (i = 0; i < n; i++)
+		push(s, 0, i);
+	for (i = 0; i < n; i++)
+		pop(s, &inf);
+}
+
+static void
+stack_destroy(void *s)
+{
+	destroystack(s);
+	free(s);
+}
+
+/*
+ * As with the lock free queue, popped nodes may still be
+ * read by other pops, so they cannot be handed out.
+ */
+const struct queue_ops stack_ops = {
+	"stack",
+	stack_create,
+	NULL,
+	stack_enqueue,
+	stack_dequeue,
+	NULL,
+	NULL,
+	NULL,
+	stack_direct,
+	stack_destroy
+};
+
+/* Two-lock queue generated by DEFINE_QUEUE (congeneric.h) */
+
+static void *
+genqueue_create(void)
+{
+	struct infoqueue *q;
+
+	q = xmalloc(sizeof(struct infoqueue));
+	infoqueue_init(q);
+	return q;
+}
+
+static void
+genqueue_enqueue(void *q, int pid, int ts)
+{
+	struct info inf;
+
+	inf.producerID = pid;
+	inf.timestamp = ts;
+	infoqueue_enqueue(q, inf);
+}
+
+static int
+genqueue_dequeue(void *q, struct info *inf)
+{
+	return infoqueue_dequeue(q, inf);
+}
+
+static void
+genqueue_direct(void *q, int n)
+{
+	struct info inf;
+	int i;
+
+	inf.producerID = 0;
+	for (i = 0; i < n; i++) {
+		inf.timestamp = i;
+		infoqueue_enqueue(q, inf);
+	}
+	for (i = 0; i < n; i++)
+		infoqueue_dequeue(q, &inf);
+}
+
+static void
+genqueue_destroy(void *q)
+{
+	infoqueue_destroy(q);
+	free(q);
+}
+
+const struct queue_ops genqueue_ops = {
+	"generic",
+	genqueue_create,
+	NULL,
+	genqueue_enqueue,
+	genqueue_dequeue,
+	NULL,
+	NULL,
+	NULL,
+	genqueue_direct,
+	genqueue_destroy
+};
+
+/* Fine grain locking BST (conbst.c) */
+
+static void *
+bst_create(void)
+{
+	struct tree *t;
+
+	/* the shards of its size counter want whole cache lines */
+	t = aligned_alloc(64, sizeof(struct tree));
+	if (t == NULL) {
+		printf("malloc() failed\n");
+		exit(EXIT_FAILURE);
+	}
+	inittree(t);
+	return t;
+}
+
+static void
+bst_insert(void *t, int pid, int ts)
+{
+	insert(t, pid, ts);
+}
+
+static int
+bst_delete(void *t, int ts, struct info *inf)
+{
+	struct tree_node *node;
+
+	node = delete_node(t, ts);
+	if (node == NULL)
+		return 0;
+	*inf = node->inf;
+	destroylock(&node->lock);
+	node_free(node);
+	return 1;
+}
+
+static int
+bst_delete_min(void *t, struct info *inf)
+{
+	struct info *result;
+
+	result = delete_min(t);
+	if (result == NULL)
+		return 0;
+	*inf = *result;
+	free(result);
+	return 1;
+}
+
+static int
+bst_lookup(void *t, int ts, struct info *inf)
+{
+	return lookup(t, ts, inf);
+}
+
+static int
+bst_lookup_batch(void *t, const int *keys, int n, struct info *out,
+    int *found)
+{
+	return lookup_batch(t, keys, n, out, found);
+}
+
+static int
+bst_insert_node(void *t, struct tree_node *n)
+{
+	return insert_node(t, n);
+}
+
+static struct tree_node *
+bst_delete_node(void *t, int ts)
+{
+	return delete_node(t, ts);
+}
+
+static struct tree_node *
+bst_wait_delete_node(void *t, int ts, long timeout)
+{
+	return wait_and_delete_node(t, ts, timeout);
+}
+
+/*
+ * Keys are inserted in a shuffled order, so the tree does not
+ * degenerate into a list.
+ */
+#define SHUFFLE(i, n) ((int)(((long)(i) * 7919) % (n)))
+
+#define DISPATCH_ROUNDS 9
+
+static long
+bst_size(void *t, int exact)
+{
+	return exact ? tree_size(t) : tree_size_approx(t);
+}
+
+static void
+bst_direct(void *t, int n)
+{
+	struct tree_node *node;
+	int i;
+
+	for (i = 0; i < n; i++)
+		insert(t, 0, SHUFFLE(i, n));
+	for (i = 0; i < n; i++) {
+		node = delete_node(t, SHUFFLE(i, n));
+		destroylock(&node->lock);
+		node_free(node);
+	}
+}
+
+static void
+bst_destroy(void *t)
+{
+	destroytree(t);
+	free(t);
+}
+
+const struct map_ops bst_ops = {
+	"bst",
+	bst_create,
+	bst_insert,
+	bst_delete,
+	bst_delete_min,
+	bst_lookup,
+	bst_lookup_batch,
+	bst_insert_node,
+	bst_delete_node,
+	bst_wait_delete_node,
+	bst_size,
+	bst_direct,
+	bst_destroy
+};
+
+/* BST generated by DEFINE_TREE (congeneric.h) */
+
+static void *
+gentree_create(void)
+{
+	struct infotree *t;
+
+	t = xmalloc(sizeof(struct infotree));
+	infotree_init(t);
+	return t;
+}
+
+static void
+gentree_insert(void *t, int pid, int ts)
+{
+	struct info inf;
+
+	inf.producerID = pid;
+	inf.timestamp = ts;
+	infotree_insert(t, ts, inf);
+}
+
+static int
+gentree_delete(void *t, int ts, struct info *inf)
+{
+	return infotree_delete(t, ts, inf);
+}
+
+static int
+gentree_delete_min(void *t, struct info *inf)
+{
+	return infotree_delete_min(t, NULL, inf);
+}
+
+static int
+gentree_lookup(void *t, int ts, struct info *inf)
+{
+	return infotree_find(t, ts, inf);
+}
+
+static void
+gentree_direct(void *t, int n)
+{
+	struct info inf;
+	int i;
+
+	inf.producerID = 0;
+	for (i = 0; i < n; i++) {
+		inf.timestamp = SHUFFLE(i, n);
+		infotree_insert(t, inf.timestamp, inf);
+	}
+	for (i = 0; i < n; i++)
+		infotree_delete(t, SHUFFLE(i, n), &inf);
+}
+
+static void
+gentree_destroy(void *t)
+{
+	infotree_destroy(t);
+	free(t);
+}
+
+const struct map_ops gentree_ops = {
+	"generic",
+	gentree_create,
+	gentree_insert,
+	gentree_delete,
+	gentree_delete_min,
+	gentree_lookup,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	gentree_direct,
+	gentree_destroy
+};
+
+const struct queue_ops *queue_backends[] = {
+	&lockqueue_ops,
+	&lfqueue_ops,
+	&uqueue_ops,
+	&lfuqueue_ops,
+	&stack_ops,
+	&genqueue_ops,
+	NULL
+};
+
+const struct map_ops *map_backends[] = {
+	&bst_ops,
+	&gentree_ops,
+	NULL
+};
+
+const struct queue_ops *
+find_queue_ops(const char *name)
+{
+	int i;
+
+	for (i = 0; queue_backends[i] != NULL; i++)
+		if (strcmp(queue_backends[i]->name, name) == 0)
+			return queue_backends[i];
+	return NULL;
+}
+
+const struct map_ops *
+find_map_ops(const char *name)
+{
+	int i;
+
+	for (i = 0; map_backends[i] != NULL; i++)
+		if (strcmp(map_backends[i]->name, name) == 0)
+			return map_backends[i];
+	return NULL;
+}
+
+/* Nanoseconds of one pass of n operations each way */
+static uint64_t
+queue_pass(const struct queue_ops *ops, const struct queue_ops *vops,
+    void *q, int n, int table)
+{
+	struct info inf;
+	uint64_t t0;
+	int i;
+
+	t0 = now_ns();
+	if (!table)
+		ops->direct(q, n);
+	else {
+		for (i = 0; i < n; i++)
+			vops->enqueue(q, 0, i);
+		for (i = 0; i < n; i++)
+			vops->dequeue(q, &inf);
+	}
+	return now_ns() - t0;
+}
+
+static uint64_t
+map_pass(const struct map_ops *ops, const struct map_ops *vops, void *t,
+    int n, int table)
+{
+	struct info inf;
+	uint64_t t0;
+	int i;
+
+	t0 = now_ns();
+	if (!table)
+		ops->direct(t, n);
+	else {
+		for (i = 0; i < n; i++)
+			vops->insert(t, 0, SHUFFLE(i, n));
+		for (i = 0; i < n; i++)
+			vops->delete(t, SHUFFLE(i, n), &inf);
+	}
+	return now_ns() - t0;
+}
+
+/*
+ * Per operation difference of the best passes. Both are noisy,
+ * and a difference below the noise would come out negative.
+ */
+static double
+overhead(uint64_t dispatched, uint64_t direct, int n)
+{
+	if (dispatched <= direct)
+		return 0.0;
+	return (double)(dispatched - direct) / (2.0 * n);
+}
+
+double
+queue_dispatch_ns(const struct queue_ops *ops, int n)
+{
+	const struct queue_ops *volatile vops = ops;
+	uint64_t t, direct, dispatched, *best;
+	void *q;
+	int round, table;
+
+	/*
+	 * Same work both ways, on the same (warm) queue, keeping
+	 * the best of a few rounds, which alternate the order of
+	 * the two passes. The volatile pointer keeps the compiler
+	 * from resolving the indirect calls.
+	 */
+	q = ops->create();
+	ops->direct(q, n);
+
+	direct = dispatched = UINT64_MAX;
+	for (round = 0; round < 2 * DISPATCH_ROUNDS; round++) {
+		table = (round + round / 2) & 1;
+		t = queue_pass(ops, vops, q, n, table);
+		best = table ? &dispatched : &direct;
+		if (t < *best)
+			*best = t;
+	}
+
+	ops->destroy(q);
+
+	return overhead(dispatched, direct, n);
+}
+
+double
+map_dispatch_ns(const struct map_ops *ops, int n)
+{
+	const struct map_ops *volatile vops = ops;
+	uint64_t t, direct, dispatched, *best;
+	void *tree;
+	int round, table;
+
+	tree = ops->create();
+	ops->direct(tree, n);
+
+	direct = dispatched = UINT64_MAX;
+	for (round = 0; round < 2 * DISPATCH_ROUNDS; round++) {
+		table = (round + round / 2) & 1;
+		t = map_pass(ops, vops, tree, n, table);
+		best = table ? &dispatched : &direct;
+		if (t < *best)
+			*best = t;
+	}
+
+	ops->destroy(tree);
+
+	return overhead(dispatched, direct, n);
+}
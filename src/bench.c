@@ -0,0 +1,609 @@
+/*
+ * Author: Giannis Giakoumakis
+ * Contact: giannis.m.giakoumakis@gmail.com
+ *
+ * Thread count scaling sweep. For every queue and tree
+ * implementation and for 1, 2, 4, ... threads up to every
+ * online CPU (plus oversubscription), run a mix of
+ * insertions and deletions for a fixed time and write the
+ * throughput as CSV, one line per point, in a stable order
+ * so that the output of two commits can be diffed. The
+ * data TLB misses of the workers come along, to compare the
+ * node allocators (-M). Trees can also be read (-L), by single
+ * or batched lookups (-B).
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/affinity.h"
+#include "../include/backend.h"
+#include "../include/lock.h"
+#include "../include/measure.h"
+#include "../include/nodealloc.h"
+#include "../include/perfcount.h"
+#include "../include/pthread_barrier.h"
+
+/* Key distributions */
+enum dist {
+	DIST_SEQ, /* per thread increasing keys, like prodcons */
+	DIST_UNIFORM,
+	DIST_ZIPF
+};
+
+static const char *distnames[] = { "seq", "uniform", "zipf" };
+
+/* Most lookups made by one lookup_batch() call */
+#define MAXBATCH 64
+
+struct benchcfg {
+	int maxthreads;
+	int oversubscribe; /* extra point at maxthreads times this */
+	double duration; /* seconds per point */
+	int repetitions;
+	int mix; /* percentage of insertions/enqueues */
+	int lookups; /* percentage of lookups, trees only, before mix */
+	int batch; /* keys per lookup, 1 for single lookups */
+	enum dist dist;
+	int keyrange;
+	double theta; /* zipf skew */
+	long prefill; /* -1 picks a default per structure */
+	char *queues; /* comma separated names, NULL for all */
+	char *maps;
+	struct affinity affinity; /* CPU of worker i */
+	FILE *out;
+};
+
+/* Zipf generator constants, after Gray et al. (as used by YCSB) */
+struct zipf {
+	double theta;
+	double alpha;
+	double zetan;
+	double eta;
+	double half;
+	long n;
+};
+
+/* One point of the sweep */
+struct point {
+	const struct queue_ops *qops; /* exactly one of the two is set */
+	const struct map_ops *mops;
+	void *ds;
+	int nthreads;
+	struct benchcfg *cfg;
+	struct zipf *zipf;
+	pthread_barrier_t barrier;
+	volatile int stop;
+};
+
+/* Per thread state, padded so counters do not share lines */
+struct worker {
+	int id;
+	struct point *pt;
+	uint64_t rng;
+	long ops;
+	long seqins; /* next sequential key to insert */
+	long seqdel; /* next sequential key to delete */
+	struct perfsample perf; /* counted while running */
+	pthread_t tid;
+	char pad[64];
+};
+
+static inline uint64_t
+xorshift(uint64_t *s)
+{
+	uint64_t x = *s;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return *s = x;
+}
+
+static void
+initzipf(struct zipf *z, long n, double theta)
+{
+	double zeta2;
+	long i;
+
+	z->n = n;
+	z->theta = theta;
+	z->zetan = 0;
+	for (i = 1; i <= n; i++)
+		z->zetan += 1.0 / pow((double)i, theta);
+	zeta2 = 1.0 + 1.0 / pow(2.0, theta);
+	z->alpha = 1.0 / (1.0 - theta);
+	z->eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / z->zetan);
+	z->half = 1.0 + pow(0.5, theta);
+}
+
+static long
+nextzipf(struct zipf *z, uint64_t *rng)
+{
+	double u, uz;
+	long k;
+
+	u = (xorshift(rng) >> 11) * (1.0 / 9007199254740992.0);
+	uz = u * z->zetan;
+	if (uz < 1.0)
+		return 0;
+	if (uz < z->half)
+		return 1;
+	k = (long)(z->n * pow(z->eta * u - z->eta + 1.0, z->alpha));
+	return (k >= z->n) ? z->n - 1 : k;
+}
+
+/*
+ * Key of the next operation. Sequential keys follow prodcons:
+ * thread id inserts id, id + T, id + 2T, ... and deletes them
+ * in the same order.
+ */
+static int
+nextkey(struct worker *w, int insert)
+{
+	struct point *pt = w->pt;
+
+	switch (pt->cfg->dist) {
+	case DIST_SEQ:
+		if (insert)
+			return (int)(w->seqins++ * pt->nthreads + w->id);
+		return (int)(w->seqdel++ * pt->nthreads + w->id);
+	case DIST_UNIFORM:
+		return (int)(xorshift(&w->rng) % pt->cfg->keyrange);
+	case DIST_ZIPF:
+		return (int)nextzipf(pt->zipf, &w->rng);
+	}
+	return 0;
+}
+
+/*
+ * Key of a lookup. Sequential keys are looked up among the
+ * ones the thread inserted so far, deleted or not.
+ */
+static int
+lookupkey(struct worker *w)
+{
+	struct point *pt = w->pt;
+
+	if (pt->cfg->dist == DIST_SEQ)
+		return (int)((xorshift(&w->rng) % (w->seqins + 1)) *
+		    pt->nthreads + w->id);
+	return nextkey(w, 0);
+}
+
+/* Look up a batch of keys, return the number of lookups */
+static int
+lookups(struct worker *w)
+{
+	struct point *pt = w->pt;
+	struct info out[MAXBATCH];
+	int keys[MAXBATCH], found[MAXBATCH];
+	int i, j, k, n;
+
+	n = pt->cfg->batch;
+	if (n == 1 || pt->mops->lookup_batch == NULL) {
+		for (i = 0; i < n; i++)
+			pt->mops->lookup(pt->ds, lookupkey(w), &out[0]);
+		return n;
+	}
+	/* insertion sort, batches are short */
+	for (i = 0; i < n; i++) {
+		k = lookupkey(w);
+		for (j = i; j > 0 && keys[j - 1] > k; j--)
+			keys[j] = keys[j - 1];
+		keys[j] = k;
+	}
+	pt->mops->lookup_batch(pt->ds, keys, n, out, found);
+	return n;
+}
+
+static void *
+work(void *arg)
+{
+	struct worker *w = arg;
+	struct point *pt = w->pt;
+	struct perfcounters pc;
+	struct perfsample s0, s1;
+	struct info inf;
+	int insert, key;
+
+	perf_open(&pc);
+	pthread_barrier_wait(&pt->barrier);
+	perf_read(&pc, &s0);
+	while (!pt->stop) {
+		if (pt->mops != NULL && pt->cfg->lookups > 0 &&
+		    (int)(xorshift(&w->rng) % 100) < pt->cfg->lookups) {
+			w->ops += lookups(w);
+			continue;
+		}
+		insert = (int)(xorshift(&w->rng) % 100) < pt->cfg->mix;
+		/* sequential deletions never overtake insertions */
+		if (pt->cfg->dist == DIST_SEQ && w->seqdel >= w->seqins)
+			insert = 1;
+		key = nextkey(w, insert);
+		if (pt->qops != NULL) {
+			if (insert)
+				pt->qops->enqueue(pt->ds, w->id, key);
+			else
+				pt->qops->dequeue(pt->ds, &inf);
+		} else {
+			if (insert)
+				pt->mops->insert(pt->ds, w->id, key);
+			else
+				pt->mops->delete(pt->ds, key, &inf);
+		}
+		w->ops++;
+	}
+	perf_read(&pc, &s1);
+	perf_diff(&w->perf, &s0, &s1);
+	perf_close(&pc);
+	return NULL;
+}
+
+/*
+ * Run one point and return its throughput in operations per
+ * second, with the counters of its workers summed into perf.
+ */
+static double
+runpoint(struct point *pt, struct perfsample *perf)
+{
+	struct benchcfg *cfg = pt->cfg;
+	struct worker *w;
+	pthread_attr_t attr;
+	struct timespec ts;
+	uint64_t rng, t0, t1;
+	long prefill, i, ops;
+	int e;
+
+	pt->ds = (pt->qops != NULL) ? pt->qops->create() :
+	    pt->mops->create();
+
+	/*
+	 * Start from a steady state: half the key range in a tree
+	 * (random keys, so the tree stays shallow), some items in
+	 * a queue. Sequential keys start from an empty structure.
+	 */
+	prefill = cfg->prefill;
+	if (prefill < 0)
+		prefill = (cfg->dist == DIST_SEQ) ? 0 :
+		    (pt->qops != NULL) ? 1024 : cfg->keyrange / 2;
+	rng = 88172645463325252ULL;
+	for (i = 0; i < prefill; i++) {
+		if (pt->qops != NULL)
+			pt->qops->enqueue(pt->ds, -1, (int)i);
+		else
+			pt->mops->insert(pt->ds, -1,
+			    (int)(xorshift(&rng) % cfg->keyrange));
+	}
+
+	w = calloc(pt->nthreads, sizeof(struct worker));
+	if (w == NULL) {
+		printf("malloc() failed\n");
+		exit(EXIT_FAILURE);
+	}
+	e = pthread_barrier_init(&pt->barrier, NULL, pt->nthreads + 1);
+	if (e != 0) {
+		printf("pthread_barrier_init() failed\n");
+		exit(EXIT_FAILURE);
+	}
+	pt->stop = 0;
+	for (i = 0; i < pt->nthreads; i++) {
+		w[i].id = (int)i;
+		w[i].pt = pt;
+		w[i].rng = 0x9E3779B97F4A7C15ULL * (i + 1);
+		affinity_attr(&cfg->affinity, (int)i, &attr);
+		e = pthread_create(&w[i].tid, &attr, work, &w[i]);
+		if (e != 0) {
+			printf("pthread_create() failed\n");
+			exit(EXIT_FAILURE);
+		}
+		pthread_attr_destroy(&attr);
+	}
+
+	pthread_barrier_wait(&pt->barrier);
+	t0 = now_ns();
+	ts.tv_sec = (time_t)cfg->duration;
+	ts.tv_nsec = (long)((cfg->duration - ts.tv_sec) * 1e9);
+	nanosleep(&ts, NULL);
+	__atomic_store_n(&pt->stop, 1, __ATOMIC_RELAXED);
+
+	ops = 0;
+	perf_zero(perf);
+	for (i = 0; i < pt->nthreads; i++) {
+		e = pthread_join(w[i].tid, NULL);
+		if (e != 0) {
+			printf("pthread_join() failed\n");
+			exit(EXIT_FAILURE);
+		}
+		ops += w[i].ops;
+		perf_add(perf, &w[i].perf);
+	}
+	t1 = now_ns();
+
+	pthread_barrier_destroy(&pt->barrier);
+	free(w);
+	if (pt->qops != NULL)
+		pt->qops->destroy(pt->ds);
+	else
+		pt->mops->destroy(pt->ds);
+	nodealloc_release();
+
+	return ops / ((t1 - t0) / 1e9);
+}
+
+/* Whether name is in a comma separated list (NULL means all) */
+static int
+selected(const char *list, const char *name)
+{
+	const char *p;
+	size_t len;
+
+	if (list == NULL)
+		return 1;
+	len = strlen(name);
+	for (p = list; p != NULL; p = strchr(p, ',')) {
+		if (*p == ',')
+			p++;
+		if (strncmp(p, name, len) == 0 &&
+		    (p[len] == ',' || p[len] == '\0'))
+			return 1;
+	}
+	return 0;
+}
+
+/* One line of output */
+static void
+print_point(struct benchcfg *cfg, const char *kind, const char *name,
+    int threads, int rep, double opsps, struct perfsample *perf)
+{
+	fprintf(cfg->out, "%s,%s,%d,%d,%d,%d,%s,%d,\"%s\",%s,%s,%d,%.0f,",
+	    kind, name, threads, cfg->mix, cfg->lookups, cfg->batch,
+	    distnames[cfg->dist], cfg->keyrange, cfg->affinity.name,
+	    LOCK_NAME, nodealloc_name(), rep, opsps);
+	/* empty where the machine does not count them */
+	if (perf->avail & (1U << PERF_DTLB_MISSES))
+		fprintf(cfg->out, "%llu",
+		    (unsigned long long)perf->v[PERF_DTLB_MISSES]);
+	fprintf(cfg->out, "\n");
+	fflush(cfg->out);
+}
+
+static void
+sweep(struct benchcfg *cfg, struct point *pt, const char *kind,
+    const char *name)
+{
+	struct perfsample perf;
+	double opsps;
+	int threads, rep, last;
+
+	last = 0;
+	for (threads = 1; ; threads *= 2) {
+		if (threads >= cfg->maxthreads) {
+			threads = cfg->maxthreads;
+			last = 1;
+		}
+		pt->nthreads = threads;
+		for (rep = 1; rep <= cfg->repetitions; rep++) {
+			opsps = runpoint(pt, &perf);
+			print_point(cfg, kind, name, threads, rep, opsps,
+			    &perf);
+		}
+		if (last)
+			break;
+	}
+
+	if (cfg->oversubscribe > 1) {
+		pt->nthreads = cfg->maxthreads * cfg->oversubscribe;
+		for (rep = 1; rep <= cfg->repetitions; rep++) {
+			opsps = runpoint(pt, &perf);
+			print_point(cfg, kind, name, pt->nthreads, rep, opsps,
+			    &perf);
+		}
+	}
+}
+
+static void
+usage(int exit_code)
+{
+	int i;
+
+	printf("usage: ./bench [options]\n"
+	    "\t-T, --threads=N       largest thread count (default: online"
+	    " CPUs)\n"
+	    "\t-x, --oversubscribe=F extra point at F times that many"
+	    " threads, 1 for none (default 2)\n"
+	    "\t-d, --duration=S      seconds per point (default 0.2)\n"
+	    "\t-r, --repetitions=R   runs per point (default 1)\n"
+	    "\t-m, --mix=P           percentage of insert/enqueue"
+	    " operations (default 50)\n"
+	    "\t-L, --lookups=P       percentage of tree operations that"
+	    " are lookups, the\n"
+	    "\t                      rest are mixed as above (default 0)\n"
+	    "\t-B, --batch=K         keys looked up at once, up to %d"
+	    " (default 1); see\n"
+	    "\t                      \"make bench-prefetch\" for trees"
+	    " larger than the cache\n"
+	    "\t-k, --keys=D          key distribution: seq, uniform or"
+	    " zipf (default uniform)\n"
+	    "\t-K, --keyrange=N      keys are in [0, N) (default 65536)\n"
+	    "\t-s, --skew=S          zipf skew, 0 < S < 1 (default 0.99)\n"
+	    "\t-P, --prefill=N       items inserted before each point"
+	    " (default: half the key range\n"
+	    "\t                      for trees, 1024 for queues)\n"
+	    "\t-q, --queues=L        comma separated queues, \"none\" to"
+	    " skip (default all):\n\t                     ", MAXBATCH);
+	for (i = 0; queue_backends[i] != NULL; i++)
+		printf(" %s", queue_backends[i]->name);
+	printf("\n\t-t, --trees=L         comma separated trees, \"none\" to"
+	    " skip (default all):\n\t                     ");
+	for (i = 0; map_backends[i] != NULL; i++)
+		printf(" %s", map_backends[i]->name);
+	printf("\n\t-a, --affinity=A      thread placement: none, compact,"
+	    " scatter or a CPU list\n\t                      like 0,2,8-11"
+	    " (default none)\n"
+	    "\t-M, --alloc=A         node allocator: malloc or arena"
+	    " (huge pages) (default\n"
+	    "\t                      malloc)\n"
+	    "\t-o, --output=F        CSV file (default stdout)\n");
+	exit(exit_code);
+}
+
+int
+main(int argc, char **argv)
+{
+	static struct option longopts[] = {
+		{ "threads",	   required_argument, NULL, 'T' },
+		{ "oversubscribe", required_argument, NULL, 'x' },
+		{ "duration",	   required_argument, NULL, 'd' },
+		{ "repetitions",   required_argument, NULL, 'r' },
+		{ "mix",	   required_argument, NULL, 'm' },
+		{ "lookups",	   required_argument, NULL, 'L' },
+		{ "batch",	   required_argument, NULL, 'B' },
+		{ "keys",	   required_argument, NULL, 'k' },
+		{ "keyrange",	   required_argument, NULL, 'K' },
+		{ "skew",	   required_argument, NULL, 's' },
+		{ "prefill",	   required_argument, NULL, 'P' },
+		{ "queues",	   required_argument, NULL, 'q' },
+		{ "trees",	   required_argument, NULL, 't' },
+		{ "affinity",	   required_argument, NULL, 'a' },
+		{ "alloc",	   required_argument, NULL, 'M' },
+		{ "output",	   required_argument, NULL, 'o' },
+		{ "help",	   no_argument,	      NULL, 'h' },
+		{ NULL,		   0,		      NULL, 0 }
+	};
+	struct benchcfg cfg;
+	struct point pt;
+	struct zipf zipf;
+	int opt, i;
+
+	cfg.maxthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	cfg.oversubscribe = 2;
+	cfg.duration = 0.2;
+	cfg.repetitions = 1;
+	cfg.mix = 50;
+	cfg.lookups = 0;
+	cfg.batch = 1;
+	cfg.dist = DIST_UNIFORM;
+	cfg.keyrange = 65536;
+	cfg.theta = 0.99;
+	cfg.prefill = -1;
+	cfg.queues = NULL;
+	cfg.maps = NULL;
+	parse_affinity(&cfg.affinity, "none");
+	cfg.out = stdout;
+
+	while ((opt = getopt_long(argc, argv,
+	    "T:x:d:r:m:L:B:k:K:s:P:q:t:a:M:o:h", longopts, NULL)) != -1) {
+		switch (opt) {
+		case 'T':
+			cfg.maxthreads = atoi(optarg);
+			break;
+		case 'x':
+			cfg.oversubscribe = atoi(optarg);
+			break;
+		case 'd':
+			cfg.duration = atof(optarg);
+			break;
+		case 'r':
+			cfg.repetitions = atoi(optarg);
+			break;
+		case 'm':
+			cfg.mix = atoi(optarg);
+			break;
+		case 'L':
+			cfg.lookups = atoi(optarg);
+			break;
+		case 'B':
+			cfg.batch = atoi(optarg);
+			break;
+		case 'k':
+			for (i = 0; i <= DIST_ZIPF; i++)
+				if (strcmp(optarg, distnames[i]) == 0)
+					break;
+			if (i > DIST_ZIPF)
+				usage(EXIT_FAILURE);
+			cfg.dist = i;
+			break;
+		case 'K':
+			cfg.keyrange = atoi(optarg);
+			break;
+		case 's':
+			cfg.theta = atof(optarg);
+			break;
+		case 'P':
+			cfg.prefill = atol(optarg);
+			break;
+		case 'q':
+			cfg.queues = optarg;
+			break;
+		case 't':
+			cfg.maps = optarg;
+			break;
+		case 'a':
+			free_affinity(&cfg.affinity);
+			if (parse_affinity(&cfg.affinity, optarg) != 0)
+				usage(EXIT_FAILURE);
+			break;
+		case 'M':
+			if (strcmp(optarg, "malloc") == 0)
+				nodealloc_use(NODEALLOC_MALLOC);
+			else if (strcmp(optarg, "arena") == 0)
+				nodealloc_use(NODEALLOC_ARENA);
+			else
+				usage(EXIT_FAILURE);
+			break;
+		case 'o':
+			cfg.out = fopen(optarg, "w");
+			if (cfg.out == NULL) {
+				printf("fopen() failed\n");
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'h':
+			usage(EXIT_SUCCESS);
+		default:
+			usage(EXIT_FAILURE);
+		}
+	}
+	if (optind != argc || cfg.maxthreads <= 0 || cfg.oversubscribe < 1 ||
+	    cfg.duration <= 0 || cfg.repetitions <= 0 || cfg.mix < 0 ||
+	    cfg.mix > 100 || cfg.lookups < 0 || cfg.lookups > 100 ||
+	    cfg.batch < 1 || cfg.batch > MAXBATCH || cfg.keyrange <= 1 ||
+	    cfg.theta <= 0 || cfg.theta >= 1)
+		usage(EXIT_FAILURE);
+
+	if (cfg.dist == DIST_ZIPF)
+		initzipf(&zipf, cfg.keyrange, cfg.theta);
+	pt.cfg = &cfg;
+	pt.zipf = &zipf;
+	/* structures are created and prefilled next to worker 0 */
+	affinity_apply(&cfg.affinity, 0);
+
+	fprintf(cfg.out, "kind,structure,threads,mix,lookups,batch,keys,"
+	    "keyrange,affinity,lock,alloc,rep,ops_per_sec,dtlb_misses\n");
+	for (i = 0; queue_backends[i] != NULL; i++) {
+		if (!selected(cfg.queues, queue_backends[i]->name))
+			continue;
+		pt.qops = queue_backends[i];
+		pt.mops = NULL;
+		sweep(&cfg, &pt, "queue", queue_backends[i]->name);
+	}
+	for (i = 0; map_backends[i] != NULL; i++) {
+		if (!selected(cfg.maps, map_backends[i]->name))
+			continue;
+		pt.qops = NULL;
+		pt.mops = map_backends[i];
+		sweep(&cfg, &pt, "tree", map_backends[i]->name);
+	}
+	if (cfg.out != stdout)
+		fclose(cfg.out);
+	free_affinity(&cfg.affinity);
+
+	return 0;
+}
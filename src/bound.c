@@ -0,0 +1,144 @@
+/*
+ * Author: Giannis Giakoumakis
+ * Contact: giannis.m.giakoumakis@gmail.com
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../include/bound.h"
+
+void
+initbound(struct bound *b, void *queue)
+{
+	int e;
+
+	b->active = 0;
+	b->capacity = 0;
+	b->count = 0;
+	b->waiters = 0;
+	b->high = 0;
+	b->low = 0;
+	b->above = 0;
+	b->watermark = NULL;
+	b->arg = NULL;
+	b->queue = queue;
+	e = pthread_mutex_init(&b->lock, NULL);
+	if (e != 0) {
+		printf("pthread_mutex_init() failed\n");
+		exit(EXIT_FAILURE);
+	}
+	e = pthread_mutex_init(&b->marklock, NULL);
+	if (e != 0) {
+		printf("pthread_mutex_init() failed\n");
+		exit(EXIT_FAILURE);
+	}
+	e = pthread_cond_init(&b->space, NULL);
+	if (e != 0) {
+		printf("pthread_cond_init() failed\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+void
+destroybound(struct bound *b)
+{
+	pthread_mutex_destroy(&b->lock);
+	pthread_mutex_destroy(&b->marklock);
+	pthread_cond_destroy(&b->space);
+}
+
+void
+setcapacity(struct bound *b, int capacity)
+{
+	b->capacity = capacity;
+	b->active = b->capacity > 0 || b->watermark != NULL;
+}
+
+void
+setwatermarks(struct bound *b, int high, int low, watermark_fn fn,
+    void *arg)
+{
+	if (fn != NULL && (low < 0 || low >= high)) {
+		printf("setwatermarks(): need 0 <= low < high\n");
+		exit(EXIT_FAILURE);
+	}
+	b->high = high;
+	b->low = low;
+	b->above = 0;
+	b->watermark = fn;
+	b->arg = arg;
+	b->active = b->capacity > 0 || b->watermark != NULL;
+}
+
+/*
+ * Called by the thread that saw the count land on a mark. The
+ * count may have moved on by the time it gets here, so report
+ * what the count is now rather than the mark it saw, and keep
+ * the check and the callback under a lock so the reports come
+ * in order. The count moves by one at a time, so any later
+ * landing on a mark comes here after us and sees its own count.
+ */
+static void
+crossed(struct bound *b)
+{
+	int n;
+
+	pthread_mutex_lock(&b->marklock);
+	n = __atomic_load_n(&b->count, __ATOMIC_SEQ_CST);
+	if (!b->above && n >= b->high) {
+		b->above = 1;
+		b->watermark(b->queue, 1, b->arg);
+	} else if (b->above && n <= b->low) {
+		b->above = 0;
+		b->watermark(b->queue, 0, b->arg);
+	}
+	pthread_mutex_unlock(&b->marklock);
+}
+
+int
+bound_take(struct bound *b)
+{
+	int n;
+
+	n = __atomic_load_n(&b->count, __ATOMIC_RELAXED);
+	do {
+		if (b->capacity > 0 && n >= b->capacity)
+			return 0;
+	} while (!__atomic_compare_exchange_n(&b->count, &n, n + 1, 1,
+	    __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+	if (b->watermark != NULL && n + 1 == b->high)
+		crossed(b);
+	return 1;
+}
+
+/*
+ * A waiter registers before it tries, and bound_give() frees
+ * the slot before it looks for waiters, so either the waiter
+ * gets the slot or it gets the signal.
+ */
+void
+bound_park(struct bound *b)
+{
+	pthread_mutex_lock(&b->lock);
+	__atomic_add_fetch(&b->waiters, 1, __ATOMIC_SEQ_CST);
+	while (!bound_take(b))
+		pthread_cond_wait(&b->space, &b->lock);
+	__atomic_sub_fetch(&b->waiters, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&b->lock);
+}
+
+void
+bound_give(struct bound *b)
+{
+	int n;
+
+	n = __atomic_sub_fetch(&b->count, 1, __ATOMIC_SEQ_CST);
+	if (b->watermark != NULL && n == b->low)
+		crossed(b);
+	if (__atomic_load_n(&b->waiters, __ATOMIC_SEQ_CST) > 0) {
+		pthread_mutex_lock(&b->lock);
+		pthread_cond_signal(&b->space);
+		pthread_mutex_unlock(&b->lock);
+	}
+}
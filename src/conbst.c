@@ -3,22 +3,82 @@
  * Contact: giannis.m.giakoumakis@gmail.com
  */
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "../include/conbst.h"
+#include "../include/keywait.h"
+#include "../include/measure.h"
+#include "../include/nodealloc.h"
+#include "../include/stats.h"
+
+/*
+ * Start loading both children of a locked node, whose child
+ * pointers cannot change under us, so the next level is on its
+ * way while we compare keys. For writing, as the lock of the
+ * child is taken next. Define _NO_PREFETCH to compare against
+ * plain descents.
+ */
+static inline void
+prefetch_children(struct tree_node *n)
+{
+#ifndef _NO_PREFETCH
+	__builtin_prefetch(n->lc, 1);
+	__builtin_prefetch(n->rc, 1);
+#endif /* _NO_PREFETCH */
+}
+
+/* Same for the one node a descent follows anyway */
+static inline void
+prefetch_node(struct tree_node *n)
+{
+#ifndef _NO_PREFETCH
+	__builtin_prefetch(n, 1);
+#endif /* _NO_PREFETCH */
+}
 
 void
 inittree(struct tree *t)
 {
-	int e;
-
 	/* Initialization of the tree */
 	t->root = NULL;
-	e = pthread_mutex_init(&t->tree_lock, NULL);
-	if (e != 0) {
-		printf("pthread_mutex_init() failed\n");
-		exit(EXIT_FAILURE);
+	initlock(&t->tree_lock);
+	initcounter(&t->size);
+}
+
+void
+destroytree(struct tree *t)
+{
+	destroysubtree(t->root);
+	t->root = NULL;
+	initcounter(&t->size);
+}
+
+void
+destroysubtree(struct tree_node *n)
+{
+	struct tree_node *l;
+
+	/*
+	 * Rotate right until the current node has no left child,
+	 * then free it and continue with its right child. This
+	 * needs neither recursion nor a stack, so degenerate trees
+	 * are fine.
+	 */
+	while (n != NULL) {
+		if (n->lc != NULL) {
+			l = n->lc;
+			n->lc = l->rc;
+			l->rc = n;
+			n = l;
+		} else {
+			l = n->rc;
+			destroylock(&n->lock);
+			node_free(n);
+			n = l;
+		}
 	}
 }
 
@@ -35,30 +95,47 @@ print_inorder(struct tree_node *n)
 		print_inorder(n->rc);
 }
 
-void
-insert(struct tree *t, int pid, int ts)
+struct tree_node *
+alloctreenode(int pid, int ts)
 {
-	struct tree_node *helper, *curr, *parent;
-	int e;
+	struct tree_node *helper;
 
-	helper = malloc(sizeof(struct tree_node));
-	if (helper == NULL) {
-		printf("malloc() failed\n");
-		exit(EXIT_FAILURE);
-	}
+	helper = node_alloc(sizeof(struct tree_node));
 
 	/* Initialize the fields of the new node */
 	helper->inf.producerID = pid;
 	helper->inf.timestamp = ts;
-	e = pthread_mutex_init(&helper->lock, NULL);
-	if (e != 0) {
-		printf("pthread_mutex_init() failed\n");
-		exit(EXIT_FAILURE);
+	initlock(&helper->lock);
+	helper->lc = NULL;
+	helper->rc = NULL;
+
+	return helper;
+}
+
+void
+insert(struct tree *t, int pid, int ts)
+{
+	struct tree_node *helper;
+
+	helper = alloctreenode(pid, ts);
+	if (!insert_node(t, helper)) {
+		destroylock(&helper->lock);
+		node_free(helper);
 	}
+}
+
+int
+insert_node(struct tree *t, struct tree_node *helper)
+{
+	struct tree_node *curr, *parent;
+	int ts;
+
+	ts = helper->inf.timestamp;
 	helper->lc = NULL;
 	helper->rc = NULL;
 
-	pthread_mutex_lock(&t->tree_lock);
+	STAT_ADD(STAT_INSERTS, 1);
+	lock_acquire(&t->tree_lock);
 	curr = t->root;
 	if (curr == NULL) {
 	/*
@@ -66,32 +143,40 @@ insert(struct tree *t, int pid, int ts)
 	 * be the root of the tree.
 	 */
 		t->root = helper;
-		pthread_mutex_unlock(&t->tree_lock);
+		lock_release(&t->tree_lock);
+		counter_add(&t->size, 1);
+		keywait_wake(t, ts);
 #ifdef _VERBOSE
 		printf("%d (root) inserted\n", ts);
 #endif /* _VERBOSE */
-		return;
+		STAT_DEPTH_END();
+		return 1;
 	}
 
 	/*
 	 * Tree is not empty, start searching for the correct
 	 * insertion point of the new allocated node.
 	 */
-	pthread_mutex_lock(&curr->lock);
-	pthread_mutex_unlock(&t->tree_lock);
+	lock_acquire(&curr->lock);
+	STAT_DESCEND(STAT_INSERT_LOCKED);
+	lock_release(&t->tree_lock);
 	while (1) {
 		parent = curr;
-		if (curr->inf.timestamp > ts) /* search left subtree */
-			curr = curr->lc;
-		else if (curr->inf.timestamp < ts) /*search right subtree */
-			curr = curr->rc;
-		else { /* found duplicate */
-			pthread_mutex_unlock(&curr->lock);
+		prefetch_children(curr);
+		if (curr->inf.timestamp == ts) { /* found duplicate */
+			lock_release(&curr->lock);
 #ifdef _VERBOSE
 			printf("Error: %d already in the tree\n", ts);
 #endif /* _VERBOSE */
-			return;
+			STAT_DEPTH_END();
+			return 0;
 		}
+		/*
+		 * Search the right subtree if the key is greater, the
+		 * left one otherwise. Indexing by the comparison leaves
+		 * no branch to mispredict on random keys.
+		 */
+		curr = curr->child[curr->inf.timestamp < ts];
 
 		if (curr != NULL) {
 		/*
@@ -99,83 +184,411 @@ insert(struct tree *t, int pid, int ts)
 		 * insertion, nor a duplicate. Continue hand over hand
 		 * locking to go deeper into the tree.
 		 */
-			pthread_mutex_lock(&curr->lock);
-			pthread_mutex_unlock(&parent->lock);
+			lock_acquire(&curr->lock);
+			STAT_DESCEND(STAT_INSERT_LOCKED);
+			lock_release(&parent->lock);
 		} else /* found the insertion point */
 			break;
 	}
 
-	if (parent->inf.timestamp > ts)
-		parent->lc = helper;
-	else
-		parent->rc = helper;
-	pthread_mutex_unlock(&parent->lock);
+	parent->child[parent->inf.timestamp < ts] = helper;
+	lock_release(&parent->lock);
+	counter_add(&t->size, 1);
+	keywait_wake(t, ts);
 #ifdef _VERBOSE
 	printf("%d inserted\n", ts);
 #endif /* _VERBOSE */
-	return;
+	STAT_DEPTH_END();
+	return 1;
+}
+
+/*
+ * Link nodes[lo..hi) into a balanced subtree whose empty child
+ * pointers are filled with slots[lo..hi], in in-order. nodes[i]
+ * comes right after slots[i]. Recursion depth is logarithmic.
+ */
+static struct tree_node *
+buildtree(struct tree_node **nodes, struct tree_node **slots,
+    int lo, int hi)
+{
+	int mid;
+
+	if (lo == hi)
+		return (slots == NULL) ? NULL : slots[lo];
+	mid = lo + (hi - lo) / 2;
+	nodes[mid]->lc = buildtree(nodes, slots, lo, mid);
+	nodes[mid]->rc = buildtree(nodes, slots, mid + 1, hi);
+	return nodes[mid];
+}
+
+/*
+ * Wake the waiters of nodes[lo..hi), just linked. The caller
+ * still holds the lock above them, so they cannot be deleted
+ * and freed under us, and a waiter looks after it is released.
+ */
+static void
+wake_linked(struct tree *t, struct tree_node **nodes, int lo, int hi)
+{
+	int i;
+
+	for (i = lo; i < hi; i++)
+		keywait_wake(t, nodes[i]->inf.timestamp);
+}
+
+void
+insert_bulk(struct tree *t, struct info *items, int n)
+{
+	struct tree_node **nodes, *sub, *curr, *parent;
+	int bounded, bound, ts;
+	int i, j, m;
+
+	if (n <= 0)
+		return;
+
+	/*
+	 * Allocate every node up front, so no allocation happens
+	 * while holding a lock. Duplicates inside the batch are
+	 * dropped here.
+	 */
+	nodes = malloc(n * sizeof(struct tree_node *));
+	if (nodes == NULL) {
+		printf("malloc() failed\n");
+		exit(EXIT_FAILURE);
+	}
+	m = 0;
+	for (i = 0; i < n; i++) {
+		if (m > 0 &&
+		    nodes[m - 1]->inf.timestamp == items[i].timestamp)
+			continue;
+		nodes[m++] = alloctreenode(items[i].producerID,
+		    items[i].timestamp);
+	}
+
+	i = 0;
+	while (i < m) {
+		ts = nodes[i]->inf.timestamp;
+
+		lock_acquire(&t->tree_lock);
+		curr = t->root;
+		if (curr == NULL) {
+		/* Tree is empty, the rest of the batch becomes the tree */
+			t->root = buildtree(nodes, NULL, i, m);
+			wake_linked(t, nodes, i, m);
+			lock_release(&t->tree_lock);
+			counter_add(&t->size, m - i);
+			break;
+		}
+		lock_acquire(&curr->lock);
+		lock_release(&t->tree_lock);
+
+		/*
+		 * Same descent as insert(), remembering the smallest key
+		 * we went left at. Every key of the batch between ts and
+		 * that bound belongs to the empty subtree we end up at.
+		 */
+		bounded = 0;
+		bound = 0;
+		while (1) {
+			parent = curr;
+			if (curr->inf.timestamp > ts) {
+				bounded = 1;
+				bound = curr->inf.timestamp;
+				curr = curr->lc;
+			} else if (curr->inf.timestamp < ts)
+				curr = curr->rc;
+			else
+				break;
+
+			if (curr != NULL) {
+				lock_acquire(&curr->lock);
+				lock_release(&parent->lock);
+			} else
+				break;
+		}
+
+		if (curr != NULL) { /* found duplicate */
+			lock_release(&curr->lock);
+			destroylock(&nodes[i]->lock);
+			node_free(nodes[i]);
+			i++;
+			continue;
+		}
+
+		j = i + 1;
+		while (j < m && (!bounded || nodes[j]->inf.timestamp < bound))
+			j++;
+		sub = buildtree(nodes, NULL, i, j);
+		if (parent->inf.timestamp > ts)
+			parent->lc = sub;
+		else
+			parent->rc = sub;
+		wake_linked(t, nodes, i, j);
+		lock_release(&parent->lock);
+		counter_add(&t->size, j - i);
+#ifdef _VERBOSE
+		printf("%d..%d inserted\n", ts, nodes[j - 1]->inf.timestamp);
+#endif /* _VERBOSE */
+		i = j;
+	}
+	free(nodes);
+}
+
+int
+delete_range(struct tree *t, int lo, int hi)
+{
+	struct tree_node **stack, **inorder, **slots, *curr;
+	int sp, cap, nnodes, nsurv, ndel;
+	int i, ts;
+
+	lock_acquire(&t->tree_lock);
+	if (t->root == NULL || lo > hi) {
+		lock_release(&t->tree_lock);
+		return 0;
+	}
+
+	cap = 64;
+	stack = malloc(cap * sizeof(struct tree_node *));
+	inorder = malloc(cap * sizeof(struct tree_node *));
+	if (stack == NULL || inorder == NULL) {
+		printf("malloc() failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/*
+	 * Lock every node that may hold a key in [lo, hi], together
+	 * with the nodes around the range, using an iterative in-order
+	 * walk. A left child is visited if the key is >= lo and a right
+	 * child if it is <= hi, so every subtree that is not visited
+	 * hangs from a surviving node and lies entirely outside the
+	 * range. Locks are held until the end (and so is the tree lock,
+	 * since the root may change), which makes the whole range
+	 * disappear at once.
+	 */
+	sp = 0;
+	nnodes = 0;
+	curr = t->root;
+	lock_acquire(&curr->lock);
+	while (curr != NULL || sp > 0) {
+		while (curr != NULL) {
+			/* every pushed node is appended to inorder later */
+			if (sp + nnodes == cap) {
+				cap *= 2;
+				stack = realloc(stack,
+				    cap * sizeof(struct tree_node *));
+				inorder = realloc(inorder,
+				    cap * sizeof(struct tree_node *));
+				if (stack == NULL || inorder == NULL) {
+					printf("realloc() failed\n");
+					exit(EXIT_FAILURE);
+				}
+			}
+			stack[sp++] = curr;
+			if (curr->inf.timestamp >= lo && curr->lc != NULL) {
+				curr = curr->lc;
+				lock_acquire(&curr->lock);
+			} else
+				curr = NULL;
+		}
+		curr = stack[--sp];
+		inorder[nnodes++] = curr;
+		if (curr->inf.timestamp <= hi && curr->rc != NULL) {
+			curr = curr->rc;
+			lock_acquire(&curr->lock);
+		} else
+			curr = NULL;
+	}
+	free(stack);
+
+	/*
+	 * Keep the surviving nodes (reusing the stack array) and the
+	 * subtrees hanging from them in in-order, then rebuild that
+	 * part of the tree balanced. A left hanging subtree precedes
+	 * its node and a right one follows it. The two can never meet
+	 * between two consecutive survivors, since one would belong to
+	 * a key < lo and the other to a key > hi.
+	 */
+	stack = malloc(nnodes * sizeof(struct tree_node *));
+	slots = malloc((nnodes + 1) * sizeof(struct tree_node *));
+	if (stack == NULL || slots == NULL) {
+		printf("malloc() failed\n");
+		exit(EXIT_FAILURE);
+	}
+	nsurv = 0;
+	slots[0] = NULL;
+	for (i = 0; i < nnodes; i++) {
+		curr = inorder[i];
+		ts = curr->inf.timestamp;
+		if (ts >= lo && ts <= hi)
+			continue;
+		if (ts < lo)
+			slots[nsurv] = curr->lc;
+		stack[nsurv++] = curr;
+		slots[nsurv] = (ts > hi) ? curr->rc : NULL;
+	}
+	t->root = buildtree(stack, slots, 0, nsurv);
+
+	/*
+	 * Nobody can wait for the lock of a deleted node, since its
+	 * parent (or the tree lock) is held, so free them right away.
+	 */
+	ndel = 0;
+	for (i = 0; i < nnodes; i++) {
+		curr = inorder[i];
+		ts = curr->inf.timestamp;
+		lock_release(&curr->lock);
+		if (ts >= lo && ts <= hi) {
+			destroylock(&curr->lock);
+			node_free(curr);
+			ndel++;
+		}
+	}
+	lock_release(&t->tree_lock);
+	counter_add(&t->size, -ndel);
+#ifdef _VERBOSE
+	printf("%d nodes in [%d, %d] deleted\n", ndel, lo, hi);
+#endif /* _VERBOSE */
+
+	free(stack);
+	free(slots);
+	free(inorder);
+	return ndel;
 }
 
 struct info *
 delete(struct tree *t, int ts)
 {
 	struct info *result;
-	struct tree_node *helper, *curr, *parent;
+	struct tree_node *node;
 
-	curr = t->root;
-	parent = t->root;
+	node = delete_node(t, ts);
+	if (node == NULL)
+		return NULL;
+
+	result = malloc(sizeof(struct info));
+	if (result == NULL) {
+		printf("malloc() failed\n");
+		exit(EXIT_FAILURE);
+	}
+	result->producerID = node->inf.producerID;
+	result->timestamp = node->inf.timestamp;
+	destroylock(&node->lock);
+	node_free(node);
+
+	return result;
+}
+
+struct info *
+wait_and_delete(struct tree *t, int ts, long timeout)
+{
+	struct info *result;
+	struct tree_node *node;
+
+	node = wait_and_delete_node(t, ts, timeout);
+	if (node == NULL)
+		return NULL;
 
 	result = malloc(sizeof(struct info));
 	if (result == NULL) {
 		printf("malloc() failed\n");
 		exit(EXIT_FAILURE);
 	}
+	*result = node->inf;
+	destroylock(&node->lock);
+	node_free(node);
+
+	return result;
+}
+
+struct tree_node *
+wait_and_delete_node(struct tree *t, int ts, long timeout)
+{
+	struct tree_node *node;
+	struct keywait w;
+	uint64_t deadline;
+
+	node = delete_node(t, ts);
+	if (node != NULL || timeout == 0)
+		return node;
+
+	/*
+	 * Look again only when an insertion of a key of our
+	 * bucket wakes us up, instead of locking a path down the
+	 * tree over and over while the key is on its way.
+	 */
+	deadline = (timeout > 0) ? now_ns() + timeout : 0;
+	keywait_begin(&w, t, ts);
+	while ((node = delete_node(t, ts)) == NULL)
+		if (!keywait_sleep(&w, deadline))
+			break;
+	keywait_end(&w);
+	return node;
+}
+
+struct tree_node *
+delete_node(struct tree *t, int ts)
+{
+	struct info tmp;
+	struct tree_node *helper, *curr, *parent;
 
-	pthread_mutex_lock(&t->tree_lock);
+	/*
+	 * The root must be read while holding the tree lock, since
+	 * delete_min()/delete_max() may free it.
+	 */
+	STAT_ADD(STAT_DELETES, 1);
+	lock_acquire(&t->tree_lock);
+	curr = t->root;
+	parent = t->root;
 	if (curr == NULL) { /* tree is empty */
-		free(result);
-		pthread_mutex_unlock(&t->tree_lock);
+		lock_release(&t->tree_lock);
 #ifdef _VERBOSE
 		printf("Error: empty tree\n");
 #endif /* _VERBOSE */
+		STAT_DEPTH_END();
 		return NULL;
 	}
 
 	/* tree is NOT empty, start checking */
-	pthread_mutex_lock(&curr->lock);
-	if (curr->inf.timestamp > ts) /* search left subtree */
-		curr = curr->lc;
-	else if (curr->inf.timestamp < ts) /* search right subtree */
-		curr = curr->rc;
+	lock_acquire(&curr->lock);
+	STAT_DESCEND(STAT_DELETE_LOCKED);
+	prefetch_children(curr);
+	if (curr->inf.timestamp != ts) /* search the subtree of ts */
+		curr = curr->child[curr->inf.timestamp < ts];
 	else { /* root should be deleted */
-		result->producerID = curr->inf.producerID;
-		result->timestamp = curr->inf.timestamp;
 		helper = findhelper(curr);
 		if (helper != NULL) {
-			curr->inf.producerID = helper->inf.producerID;
-			curr->inf.timestamp = helper->inf.timestamp;
-			free(helper);
-		} else
+		/*
+		 * The helper node takes the place of the root, so the
+		 * helper node is handed out carrying the deleted value.
+		 */
+			tmp = curr->inf;
+			curr->inf = helper->inf;
+			helper->inf = tmp;
+		} else {
 			t->root = NULL;
-		pthread_mutex_unlock(&curr->lock);
-		pthread_mutex_unlock(&t->tree_lock);
+			helper = curr;
+		}
+		lock_release(&curr->lock);
+		lock_release(&t->tree_lock);
+		counter_add(&t->size, -1);
 #ifdef _VERBOSE
 		printf("%d (root) deleted\n", ts);
 #endif /* _VERBOSE */
-		return result;
+		STAT_DEPTH_END();
+		return helper;
 	}
 
 	/* should NOT delete the root */
 	if (curr != NULL) {
-		pthread_mutex_lock(&curr->lock);
-		pthread_mutex_unlock(&t->tree_lock);
+		lock_acquire(&curr->lock);
+		STAT_DESCEND(STAT_DELETE_LOCKED);
+		lock_release(&t->tree_lock);
 	} else {
-		free(result);
-		pthread_mutex_unlock(&t->tree_lock);
-		pthread_mutex_unlock(&parent->lock);
+		lock_release(&t->tree_lock);
+		lock_release(&parent->lock);
 #ifdef _VERBOSE
 		printf("Error: %d does not exist\n", ts);
 #endif /* _VERBOSE */
+		STAT_DEPTH_END();
 		return NULL;
 	}
 
@@ -184,37 +597,34 @@ delete(struct tree *t, int ts)
 	 * corresponding (to the ts) node may not exist at all.
 	 */
 	while (1) {
-		if (curr->inf.timestamp > ts) {
-		/* search left subtree */
-			pthread_mutex_unlock(&parent->lock);
-			parent = curr;
-			curr = curr->lc;
-		} else if (curr->inf.timestamp < ts) {
-		/* search right subtree */
-			pthread_mutex_unlock(&parent->lock);
+		prefetch_children(curr);
+		if (curr->inf.timestamp != ts) {
+		/* search the right subtree if ts is greater, else the left */
+			lock_release(&parent->lock);
 			parent = curr;
-			curr = curr->rc;
+			curr = curr->child[curr->inf.timestamp < ts];
 		} else {
 		/* found the node that should be deleted */
-			result->producerID = curr->inf.producerID;
-			result->timestamp = curr->inf.timestamp;
 			helper = findhelper(curr);
 			if (helper != NULL) {
-				curr->inf.producerID = helper->inf.producerID;
-				curr->inf.timestamp = helper->inf.timestamp;
-				free(helper);
+				tmp = curr->inf;
+				curr->inf = helper->inf;
+				helper->inf = tmp;
 			} else {
 				if (parent->lc == curr)
 					parent->lc = NULL;
 				else
 					parent->rc = NULL;
+				helper = curr;
 			}
-			pthread_mutex_unlock(&curr->lock);
-			pthread_mutex_unlock(&parent->lock);
+			lock_release(&curr->lock);
+			lock_release(&parent->lock);
+			counter_add(&t->size, -1);
 #ifdef _VERBOSE
 			printf("%d deleted\n", ts);
 #endif /* _VERBOSE */
-			return result;
+			STAT_DEPTH_END();
+			return helper;
 		}
 
 		if (curr == NULL) {
@@ -224,11 +634,11 @@ delete(struct tree *t, int ts)
 		 * NULL pointer to indicate that no deletion took
 		 * place.
 		 */
-			free(result);
-			pthread_mutex_unlock(&parent->lock);
+			lock_release(&parent->lock);
 #ifdef _VERBOSE
 			printf("Error: %d does not exist\n", ts);
 #endif /* _VERBOSE */
+			STAT_DEPTH_END();
 			return NULL;
 		}
 
@@ -236,15 +646,415 @@ delete(struct tree *t, int ts)
 		 * Lock the current node and repeat until search either
 		 * succeeds or it fails.
 		 */
-		pthread_mutex_lock(&curr->lock);
+		lock_acquire(&curr->lock);
+		STAT_DESCEND(STAT_DELETE_LOCKED);
 	}
 }
 
+/*
+ * Common code of delete_min() and delete_max(). The extreme
+ * node is found by following only left (or only right) children
+ * using hand over hand locking, so it never has the child on that
+ * side and can be unlinked by handing its other child to its
+ * parent.
+ */
+static struct info *
+delete_edge(struct tree *t, int max)
+{
+	struct info *result;
+	struct tree_node *curr, *parent, *next;
+
+	result = malloc(sizeof(struct info));
+	if (result == NULL) {
+		printf("malloc() failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	lock_acquire(&t->tree_lock);
+	curr = t->root;
+	if (curr == NULL) { /* tree is empty */
+		free(result);
+		lock_release(&t->tree_lock);
+#ifdef _VERBOSE
+		printf("Error: empty tree\n");
+#endif /* _VERBOSE */
+		return NULL;
+	}
+
+	lock_acquire(&curr->lock);
+	next = max ? curr->rc : curr->lc;
+	if (next == NULL) {
+	/*
+	 * The root holds the extreme key, so its only child (if
+	 * any) becomes the new root. The tree lock is still held,
+	 * so no other thread can be waiting for the lock of the
+	 * old root.
+	 */
+		t->root = max ? curr->lc : curr->rc;
+		lock_release(&curr->lock);
+		lock_release(&t->tree_lock);
+		counter_add(&t->size, -1);
+		result->producerID = curr->inf.producerID;
+		result->timestamp = curr->inf.timestamp;
+		destroylock(&curr->lock);
+		node_free(curr);
+#ifdef _VERBOSE
+		printf("%d (root) deleted\n", result->timestamp);
+#endif /* _VERBOSE */
+		return result;
+	}
+	lock_release(&t->tree_lock);
+
+	parent = curr;
+	curr = next;
+	lock_acquire(&curr->lock);
+	while (1) {
+		next = max ? curr->rc : curr->lc;
+		if (next == NULL)
+			break;
+		lock_release(&parent->lock);
+		parent = curr;
+		curr = next;
+		lock_acquire(&curr->lock);
+	}
+
+	if (max)
+		parent->rc = curr->lc;
+	else
+		parent->lc = curr->rc;
+	lock_release(&curr->lock);
+	lock_release(&parent->lock);
+	counter_add(&t->size, -1);
+
+	/*
+	 * Any thread that wants to lock curr has to hold the lock of
+	 * its parent first, so curr is unreachable from now on.
+	 */
+	result->producerID = curr->inf.producerID;
+	result->timestamp = curr->inf.timestamp;
+	destroylock(&curr->lock);
+	node_free(curr);
+#ifdef _VERBOSE
+	printf("%d deleted\n", result->timestamp);
+#endif /* _VERBOSE */
+	return result;
+}
+
+struct info *
+delete_min(struct tree *t)
+{
+	return delete_edge(t, 0);
+}
+
+struct info *
+delete_max(struct tree *t)
+{
+	return delete_edge(t, 1);
+}
+
+int
+lookup(struct tree *t, int ts, struct info *inf)
+{
+	struct tree_node *curr, *parent;
+
+	lock_acquire(&t->tree_lock);
+	curr = t->root;
+	if (curr == NULL) {
+		lock_release(&t->tree_lock);
+		return 0;
+	}
+	lock_acquire(&curr->lock);
+	lock_release(&t->tree_lock);
+	while (1) {
+		prefetch_children(curr);
+		if (curr->inf.timestamp == ts) {
+			*inf = curr->inf;
+			lock_release(&curr->lock);
+			return 1;
+		}
+		parent = curr;
+		curr = curr->child[curr->inf.timestamp < ts];
+		if (curr == NULL) {
+			lock_release(&parent->lock);
+			return 0;
+		}
+		lock_acquire(&curr->lock);
+		lock_release(&parent->lock);
+	}
+}
+
+/* Keys of a batch on their way through a locked node */
+struct probe {
+	struct tree_node *node;
+	int lo;		/* keys[lo..hi) */
+	int hi;
+};
+
+int
+lookup_batch(struct tree *t, const int *keys, int n, struct info *out,
+    int *found)
+{
+	struct probe *probes, *cur, *next, *tmp;
+	struct tree_node *node;
+	int ncur, nnext, nfound, i, m, e, ts;
+
+	for (i = 0; i < n; i++)
+		found[i] = 0;
+	if (n <= 0)
+		return 0;
+	/* a probe holds a key at least, so a level has n at most */
+	probes = malloc(2 * n * sizeof(struct probe));
+	if (probes == NULL) {
+		printf("malloc() failed\n");
+		exit(EXIT_FAILURE);
+	}
+	cur = probes;
+	next = probes + n;
+
+	lock_acquire(&t->tree_lock);
+	if (t->root == NULL) {
+		lock_release(&t->tree_lock);
+		free(probes);
+		return 0;
+	}
+	cur[0].node = t->root;
+	cur[0].lo = 0;
+	cur[0].hi = n;
+	ncur = 1;
+	lock_acquire(&t->root->lock);
+	lock_release(&t->tree_lock);
+
+	/*
+	 * Descend level by level, splitting the sorted keys at every
+	 * node. As in walk_locked(), children are locked before
+	 * their parent is released, so the lookups see the tree as
+	 * of one moment. The children of the whole level are
+	 * prefetched before any of them is needed, so their misses
+	 * overlap instead of following one another.
+	 */
+	nfound = 0;
+	while (ncur > 0) {
+		for (i = 0; i < ncur; i++)
+			prefetch_children(cur[i].node);
+		nnext = 0;
+		for (i = 0; i < ncur; i++) {
+			node = cur[i].node;
+			ts = node->inf.timestamp;
+			/* keys[lo..m) < ts == keys[m..e) < keys[e..hi) */
+			for (m = cur[i].lo; m < cur[i].hi && keys[m] < ts; m++)
+				;
+			for (e = m; e < cur[i].hi && keys[e] == ts; e++) {
+				out[e] = node->inf;
+				found[e] = 1;
+				nfound++;
+			}
+			if (m > cur[i].lo && node->lc != NULL) {
+				lock_acquire(&node->lc->lock);
+				next[nnext].node = node->lc;
+				next[nnext].lo = cur[i].lo;
+				next[nnext++].hi = m;
+			}
+			if (e < cur[i].hi && node->rc != NULL) {
+				lock_acquire(&node->rc->lock);
+				next[nnext].node = node->rc;
+				next[nnext].lo = e;
+				next[nnext++].hi = cur[i].hi;
+			}
+			lock_release(&node->lock);
+		}
+		tmp = cur;
+		cur = next;
+		next = tmp;
+		ncur = nnext;
+	}
+	free(probes);
+	return nfound;
+}
+
+static int
+cmpinfo(const void *a, const void *b)
+{
+	const struct info *x = a, *y = b;
+
+	return (x->timestamp > y->timestamp) -
+	    (x->timestamp < y->timestamp);
+}
+
+/*
+ * Call visit for every node of a BST whose key lies in [lo, hi],
+ * in preorder, while holding its lock.
+ */
+static void
+walk_locked(struct tree *t, int lo, int hi,
+    void (*visit)(struct tree_node *, void *), void *arg)
+{
+	struct tree_node **stack, *n;
+	int sp, cap;
+
+	lock_acquire(&t->tree_lock);
+	if (t->root == NULL || lo > hi) {
+		lock_release(&t->tree_lock);
+		return;
+	}
+
+	cap = 64;
+	stack = malloc(cap * sizeof(struct tree_node *));
+	if (stack == NULL) {
+		printf("malloc() failed\n");
+		exit(EXIT_FAILURE);
+	}
+	sp = 0;
+	stack[sp++] = t->root;
+	lock_acquire(&t->root->lock);
+	lock_release(&t->tree_lock);
+
+	/*
+	 * Visit the part of the tree that may hold keys in [lo, hi]
+	 * using an explicit stack. Every node on the stack is locked
+	 * and a node is unlocked only after the children that have
+	 * to be visited are locked. This is a generalization of hand
+	 * over hand locking (the tree locking protocol): other threads
+	 * cannot overtake the walk, nor can they change a part of the
+	 * tree the walk has already passed in a way the walk would not
+	 * see, so what it sees is linearizable.
+	 */
+	while (sp > 0) {
+		n = stack[--sp];
+		if (n->inf.timestamp >= lo && n->inf.timestamp <= hi)
+			visit(n, arg);
+		if (sp + 2 > cap) {
+			cap *= 2;
+			stack = realloc(stack,
+			    cap * sizeof(struct tree_node *));
+			if (stack == NULL) {
+				printf("realloc() failed\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+		if (n->inf.timestamp < hi && n->rc != NULL) {
+			lock_acquire(&n->rc->lock);
+			stack[sp++] = n->rc;
+		}
+		if (n->inf.timestamp > lo && n->lc != NULL) {
+			lock_acquire(&n->lc->lock);
+			stack[sp++] = n->lc;
+		}
+		lock_release(&n->lock);
+	}
+	free(stack);
+}
+
+/* Snapshot being collected, size is the room in items */
+struct collector {
+	struct tree_snapshot *s;
+	int size;
+};
+
+static void
+collect(struct tree_node *n, void *arg)
+{
+	struct collector *c = arg;
+	struct tree_snapshot *s = c->s;
+
+	if (s->nitems == c->size) {
+		c->size = (c->size == 0) ? 64 : c->size * 2;
+		s->items = realloc(s->items, c->size * sizeof(struct info));
+		if (s->items == NULL) {
+			printf("realloc() failed\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	s->items[s->nitems++] = n->inf;
+}
+
+void
+snapshot_tree(struct tree *t, int lo, int hi, struct tree_snapshot *s)
+{
+	struct collector c;
+
+	s->items = NULL;
+	s->nitems = 0;
+	s->pos = 0;
+	c.s = s;
+	c.size = 0;
+	walk_locked(t, lo, hi, collect, &c);
+
+	/*
+	 * Nodes are visited in preorder, while deletions may move keys
+	 * upwards, so sort the collected values.
+	 */
+	if (s->nitems > 1)
+		qsort(s->items, s->nitems, sizeof(struct info), cmpinfo);
+}
+
+struct info *
+snapshot_next(struct tree_snapshot *s)
+{
+	if (s->pos >= s->nitems)
+		return NULL;
+	return &s->items[s->pos++];
+}
+
+void
+snapshot_free(struct tree_snapshot *s)
+{
+	free(s->items);
+	s->items = NULL;
+	s->nitems = 0;
+	s->pos = 0;
+}
+
+void
+range_scan(struct tree *t, int lo, int hi,
+    void (*func)(struct info *, void *), void *arg)
+{
+	struct tree_snapshot s;
+	struct info *inf;
+
+	snapshot_tree(t, lo, hi, &s);
+	while ((inf = snapshot_next(&s)) != NULL)
+		func(inf, arg);
+	snapshot_free(&s);
+}
+
+static void
+count(struct tree_node *n, void *arg)
+{
+	(*(long *)arg)++;
+}
+
+long
+tree_size(struct tree *t)
+{
+	long n = 0;
+
+	walk_locked(t, INT_MIN, INT_MAX, count, &n);
+	return n;
+}
+
+long
+tree_size_approx(struct tree *t)
+{
+	long n;
+
+	n = counter_read(&t->size);
+	return (n > 0) ? n : 0;
+}
+
+int
+tree_is_empty(struct tree *t)
+{
+	/* only compared, never followed, so no lock is needed */
+	return __atomic_load_n(&t->root, __ATOMIC_ACQUIRE) == NULL;
+}
+
 struct tree_node *
 findhelper(struct tree_node *n)
 {
 	struct tree_node *curr, *parent;
 
+	STAT_ADD(STAT_FINDHELPERS, 1);
+
 	/*
 	 * No children exist, node will be physically deleted from the
 	 * tree, no value replacement will happen.
@@ -262,25 +1072,30 @@ findhelper(struct tree_node *n)
 	 */
 		parent = n;
 		curr = n->lc;
-		pthread_mutex_lock(&curr->lock);
+		lock_acquire(&curr->lock);
+		STAT_ADD(STAT_FINDHELPER_LOCKED, 1);
 		while(curr->rc != NULL) {
+			prefetch_node(curr->rc);
 			if (parent != n)
-				pthread_mutex_unlock(&parent->lock);
+				lock_release(&parent->lock);
 			parent = curr;
 			curr = curr->rc;
-			pthread_mutex_lock(&curr->lock);
+			lock_acquire(&curr->lock);
+			STAT_ADD(STAT_FINDHELPER_LOCKED, 1);
+		}
+		if (curr->lc != NULL) {
+			lock_acquire(&curr->lc->lock);
+			STAT_ADD(STAT_FINDHELPER_LOCKED, 1);
 		}
-		if (curr->lc != NULL)
-			pthread_mutex_lock(&curr->lc->lock);
 		if (parent == n)
 			parent->lc = curr->lc;
 		else {
 			parent->rc = curr->lc;
-			pthread_mutex_unlock(&parent->lock);
+			lock_release(&parent->lock);
 		}
 		if (curr->lc != NULL)
-			pthread_mutex_unlock(&curr->lc->lock);
-		pthread_mutex_unlock(&curr->lock);
+			lock_release(&curr->lc->lock);
+		lock_release(&curr->lock);
 		return curr;
 	} else {
 	/*
@@ -293,25 +1108,30 @@ findhelper(struct tree_node *n)
 	 */
 		parent = n;
 		curr = n->rc;
-		pthread_mutex_lock(&curr->lock);
+		lock_acquire(&curr->lock);
+		STAT_ADD(STAT_FINDHELPER_LOCKED, 1);
 		while(curr->lc != NULL) {
+			prefetch_node(curr->lc);
 			if (parent != n)
-				pthread_mutex_unlock(&parent->lock);
+				lock_release(&parent->lock);
 			parent = curr;
 			curr = curr->lc;
-			pthread_mutex_lock(&curr->lock);
+			lock_acquire(&curr->lock);
+			STAT_ADD(STAT_FINDHELPER_LOCKED, 1);
+		}
+		if (curr->rc != NULL) {
+			lock_acquire(&curr->rc->lock);
+			STAT_ADD(STAT_FINDHELPER_LOCKED, 1);
 		}
-		if (curr->rc != NULL)
-			pthread_mutex_lock(&curr->rc->lock);
 		if (parent == n)
 			parent->rc = curr->rc;
 		else {
 			parent->lc = curr->rc;
-			pthread_mutex_unlock(&parent->lock);
+			lock_release(&parent->lock);
 		}
 		if (curr->rc != NULL)
-			pthread_mutex_unlock(&curr->rc->lock);
-		pthread_mutex_unlock(&curr->lock);
+			lock_release(&curr->rc->lock);
+		lock_release(&curr->lock);
 		return curr;
 	}
 }
@@ -320,6 +1140,42 @@ findhelper(struct tree_node *n)
 
 #define NUM_THREADS 2
 
+void
+print_info(struct info *inf, void *arg)
+{
+	printf("%s: producerID=%d timestamp=%d\n", (char *)arg,
+	    inf->producerID, inf->timestamp);
+}
+
+void
+scan_info(struct info *inf, void *arg)
+{
+	struct scan *sc = arg;
+
+	print_info(inf, (void *)sc->name);
+	if (sc->n < 16)
+		sc->keys[sc->n] = inf->timestamp;
+	sc->n++;
+}
+
+/* Exit unless a scan went through exactly the n given keys */
+void
+check_scan(struct scan *sc, const int *keys, int n)
+{
+	int i;
+
+	if (sc->n != n) {
+		printf("%s: %d keys instead of %d\n", sc->name, sc->n, n);
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < n; i++)
+		if (sc->keys[i] != keys[i]) {
+			printf("%s: key %d instead of %d\n", sc->name,
+			    sc->keys[i], keys[i]);
+			exit(EXIT_FAILURE);
+		}
+}
+
 void *
 produce_consume(void *arg)
 {
@@ -356,6 +1212,21 @@ produce_consume(void *arg)
 	}
 }
 
+/* Wait for the key passed as argument, return its producerID */
+void *
+waiter(void *arg)
+{
+	struct info *result;
+	long pid;
+
+	result = wait_and_delete(arg, 42, -1);
+	if (result == NULL)
+		return (void *)-1L;
+	pid = result->producerID;
+	free(result);
+	return (void *)pid;
+}
+
 int
 main()
 {
@@ -376,6 +1247,13 @@ main()
 	pthread_barrier_t barrier;
 	struct tree t;
 	struct product prod;
+	struct tree_snapshot snap;
+	struct scan sc;
+	static const int sorted[8] = { 5, 7, 8, 10, 11, 12, 19, 25 };
+	static const int inrange[5] = { 7, 8, 10, 11, 12 };
+	struct info batch[16], found[100];
+	struct info *result;
+	int keys[100], hits[100];
 	int i, e;
 
 	inittree(&t);
@@ -441,6 +1319,146 @@ main()
 	}
 	print_inorder(t.root);
 
+	/*
+	 * Unit test #3 (serial execution)
+	 * Scan a range and take a snapshot of the tree, then
+	 * drain it from both ends. The keys should come out in
+	 * increasing and decreasing order respectively.
+	 */
+	printf("Unit test #3 (serial execution)\n");
+	insert(&t, 10, 10);
+	insert(&t, 8, 8);
+	insert(&t, 12, 12);
+	insert(&t, 5, 5);
+	insert(&t, 19, 19);
+	insert(&t, 11, 11);
+	insert(&t, 25, 25);
+	insert(&t, 7, 7);
+	sc.name = "range [7, 12]";
+	sc.n = 0;
+	range_scan(&t, 7, 12, scan_info, &sc);
+	check_scan(&sc, inrange, 5);
+	sc.name = "snapshot [0, 100]";
+	sc.n = 0;
+	snapshot_tree(&t, 0, 100, &snap);
+	while ((result = snapshot_next(&snap)) != NULL)
+		scan_info(result, &sc);
+	snapshot_free(&snap);
+	check_scan(&sc, sorted, 8);
+	for (i = 0; i < 8; i++) {
+		/* the four smallest keys, then the rest from the top */
+		result = (i < 4) ? delete_min(&t) : delete_max(&t);
+		if (result == NULL) {
+			printf("delete_%s() found an empty tree\n",
+			    (i < 4) ? "min" : "max");
+			exit(EXIT_FAILURE);
+		}
+		printf("%s: producerID=%d timestamp=%d\n",
+		    (i < 4) ? "min" : "max", result->producerID,
+		    result->timestamp);
+		if (result->timestamp != sorted[(i < 4) ? i : 11 - i]) {
+			printf("delete_%s() is out of order\n",
+			    (i < 4) ? "min" : "max");
+			exit(EXIT_FAILURE);
+		}
+		free(result);
+	}
+	if (delete_max(&t) != NULL || !tree_is_empty(&t)) {
+		printf("delete_max() left nodes behind\n");
+		exit(EXIT_FAILURE);
+	}
+	print_inorder(t.root);
+
+	/*
+	 * Unit test #4 (serial execution)
+	 * Bulk insert two batches, the second one filling the gaps
+	 * of the first, then delete a range spanning both.
+	 */
+	printf("Unit test #4 (serial execution)\n");
+	for (i = 0; i < 16; i++) {
+		batch[i].producerID = 0;
+		batch[i].timestamp = i * 4;
+	}
+	insert_bulk(&t, batch, 16);
+	for (i = 0; i < 16; i++) {
+		batch[i].producerID = 1;
+		batch[i].timestamp = i * 2 + 1;
+	}
+	insert_bulk(&t, batch, 16);
+	printf("%d nodes deleted\n", delete_range(&t, 6, 50));
+	print_inorder(t.root);
+	printf("size=%ld approx=%ld empty=%d\n", tree_size(&t),
+	    tree_size_approx(&t), tree_is_empty(&t));
+	if (tree_size(&t) != 8 || tree_size_approx(&t) != 8) {
+		printf("tree_size() is off\n");
+		exit(EXIT_FAILURE);
+	}
+	printf("%d nodes deleted\n", delete_range(&t, -1, 100));
+	print_inorder(t.root);
+	if (tree_size(&t) != 0 || !tree_is_empty(&t)) {
+		printf("tree_size() is off\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/*
+	 * Unit test #5 (concurrent execution)
+	 * A thread waits for a key that is missing, which an
+	 * insertion later on hands to it; waiting for another one
+	 * times out.
+	 */
+	printf("Unit test #5 (concurrent execution)\n");
+	if (wait_and_delete(&t, 43, 1000000) != NULL) {
+		printf("wait_and_delete() found a missing key\n");
+		exit(EXIT_FAILURE);
+	}
+	e = pthread_create(&tid[0], NULL, waiter, &t);
+	if (e != 0) {
+		printf("pthread_create() failed\n");
+		exit(EXIT_FAILURE);
+	}
+	usleep(10000);
+	insert(&t, 7, 42);
+	e = pthread_join(tid[0], (void **)&result);
+	if (e != 0) {
+		printf("pthread_join() failed\n");
+		exit(EXIT_FAILURE);
+	}
+	printf("waiter got producerID=%ld\n", (long)result);
+	if ((long)result != 7 || !tree_is_empty(&t)) {
+		printf("wait_and_delete() missed the key\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/*
+	 * Unit test #6 (serial execution)
+	 * Look the odd keys of 0..99 up one by one and in a batch
+	 * that has the even ones as well.
+	 */
+	printf("Unit test #6 (serial execution)\n");
+	for (i = 0; i < 50; i++)
+		insert(&t, i, ((i * 7) % 50) * 2 + 1);
+	for (i = 0; i < 100; i++)
+		if (lookup(&t, i, &batch[0]) != (i % 2) ||
+		    ((i % 2) && batch[0].timestamp != i)) {
+			printf("lookup(%d) is off\n", i);
+			exit(EXIT_FAILURE);
+		}
+	for (i = 0; i < 100; i++)
+		keys[i] = i;
+	e = lookup_batch(&t, keys, 100, found, hits);
+	printf("%d of 100 keys found in a batch\n", e);
+	for (i = 0; i < 100; i++)
+		if (hits[i] != (i % 2) ||
+		    (hits[i] && found[i].timestamp != i)) {
+			printf("lookup_batch() is off at %d\n", i);
+			exit(EXIT_FAILURE);
+		}
+	if (e != 50) {
+		printf("lookup_batch() is off\n");
+		exit(EXIT_FAILURE);
+	}
+	delete_range(&t, 0, 100);
+
 	return 0;
 }
 
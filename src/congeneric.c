@@ -0,0 +1,119 @@
+/*
+ * Author: Giannis Giakoumakis
+ * Contact: giannis.m.giakoumakis@gmail.com
+ *
+ * The generic structures live entirely in congeneric.h,
+ * this file only holds their unit test.
+ */
+
+#ifdef _UTEST
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../include/congeneric.h"
+
+#define NUM_THREADS 4
+#define NUM_ITEMS 1000
+
+/* A payload too large for struct info, stored inline */
+struct payload {
+	uint64_t key;
+	int producerID;
+	char tag[32];
+};
+
+DEFINE_QUEUE(pqueue, struct payload)
+DEFINE_TREE(ptree, uint64_t, struct payload, GENERIC_CMP)
+
+struct pqueue q;
+struct ptree t;
+
+void *
+produce_consume(void *arg)
+{
+	struct payload p;
+	int self_id, i;
+
+	self_id = (int)(long)arg;
+
+	/* Keys beyond the range of an int */
+	for (i = 0; i < NUM_ITEMS; i++) {
+		p.key = ((uint64_t)1 << 40) + i * NUM_THREADS + self_id;
+		p.producerID = self_id;
+		snprintf(p.tag, sizeof(p.tag), "item%d", i);
+		pqueue_enqueue(&q, p);
+	}
+
+	/* Move whatever this thread dequeues into the tree */
+	while (pqueue_dequeue(&q, &p))
+		ptree_insert(&t, p.key, p);
+
+	return NULL;
+}
+
+int
+main()
+{
+	pthread_t tid[NUM_THREADS];
+	struct payload p;
+	uint64_t key;
+	int i, e, found;
+
+	pqueue_init(&q);
+	ptree_init(&t);
+
+	printf("Unit test #1 (concurrent execution)\n");
+	for (i = 0; i < NUM_THREADS; i++) {
+		e = pthread_create(&tid[i], NULL, produce_consume,
+		    (void *)(long)i);
+		if (e != 0) {
+			printf("pthread_create() failed\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	for (i = 0; i < NUM_THREADS; i++) {
+		e = pthread_join(tid[i], NULL);
+		if (e != 0) {
+			printf("pthread_join() failed\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	/* Every key must be found exactly once */
+	found = 0;
+	for (i = 0; i < NUM_ITEMS * NUM_THREADS; i++) {
+		key = ((uint64_t)1 << 40) + i;
+		if (ptree_find(&t, key, &p) && p.key == key)
+			found++;
+		if (!ptree_delete(&t, key, NULL))
+			printf("Error: %llu missing\n",
+			    (unsigned long long)key);
+	}
+	printf("found %d of %d keys, root=%p\n", found,
+	    NUM_ITEMS * NUM_THREADS, (void *)t.root);
+
+	printf("Unit test #2 (serial execution)\n");
+	for (i = 0; i < 8; i++) {
+		p.key = (i * 5) % 8;
+		p.producerID = i;
+		snprintf(p.tag, sizeof(p.tag), "tag%d", i);
+		ptree_insert(&t, p.key, p);
+	}
+	printf("duplicate insert returned %d\n", ptree_insert(&t, 3, p));
+	/* the four smallest keys come out in order */
+	for (i = 0; i < 4; i++)
+		if (ptree_delete_min(&t, &key, &p))
+			printf("deleted min key=%llu tag=%s\n",
+			    (unsigned long long)key, p.tag);
+	for (i = 7; i >= 0; i--) {
+		if (ptree_delete(&t, i, &p))
+			printf("deleted key=%llu producerID=%d tag=%s\n",
+			    (unsigned long long)p.key, p.producerID, p.tag);
+	}
+
+	return 0;
+}
+
+#endif /* _UTEST */
@@ -7,6 +7,8 @@
 #include <stdio.h>
 
 #include "../include/conlfqueue.h"
+#include "../include/nodealloc.h"
+#include "../include/stats.h"
 
 #define CAS __sync_bool_compare_and_swap
 
@@ -16,32 +18,27 @@ initlfqueue(struct lfqueue *q)
 	int e;
 	struct lfqueue_node *node;
 
-	node = malloc(sizeof(struct lfqueue_node));
-	if (node == NULL) {
-		printf("malloc() failed\n");
-		exit(EXIT_FAILURE);
-	}
+	node = node_alloc(sizeof(struct lfqueue_node));
 
 	/* Sentinel node values */
 	node->inf.producerID = -1;
 	node->inf.timestamp = -1;
 	node->next = NULL;
+	node->seq = 0;
 
 	/* Initialization of the lock free queue */
 	q->Head = node;
 	q->Tail = node;
+	initbound(&q->bound, q);
 }
 
-void
-lfenqueue(struct lfqueue *q, int pid, int ts)
+/* Append a new node, the bound has made room for it */
+static void
+lflink(struct lfqueue *q, int pid, int ts)
 {
 	struct lfqueue_node *next, *last, *node;
 
-	node = malloc(sizeof(struct lfqueue_node));
-	if (node == NULL) {
-		printf("malloc() failed\n");
-		exit(EXIT_FAILURE);
-	}
+	node = node_alloc(sizeof(struct lfqueue_node));
 
 	/* Initialize the fields of the new node */
 	node->inf.producerID = pid;
@@ -53,6 +50,8 @@ lfenqueue(struct lfqueue *q, int pid, int ts)
 		next = last->next;
 		if (last == q->Tail) {
 			if (next == NULL) {
+				node->seq = last->seq + 1;
+				STAT_ADD(STAT_CAS, 1);
 				if (CAS(&last->next, next, node)) {
 #ifdef _VERBOSE
 					printf("Enqueue {producerID=%d"
@@ -61,11 +60,33 @@ lfenqueue(struct lfqueue *q, int pid, int ts)
 #endif /* _VERBOSE */
 					break;
 				}
-			} else
-				CAS(&q->Tail, last, next);
+				STAT_ADD(STAT_CAS_FAILED, 1);
+			} else {
+				STAT_ADD(STAT_CAS, 1);
+				if (!CAS(&q->Tail, last, next))
+					STAT_ADD(STAT_CAS_FAILED, 1);
+			}
 		}
 	}
-	CAS(&q->Tail, last, node);
+	STAT_ADD(STAT_CAS, 1);
+	if (!CAS(&q->Tail, last, node))
+		STAT_ADD(STAT_CAS_FAILED, 1);
+}
+
+void
+lfenqueue(struct lfqueue *q, int pid, int ts)
+{
+	bound_wait(&q->bound);
+	lflink(q, pid, ts);
+}
+
+int
+lftry_enqueue(struct lfqueue *q, int pid, int ts)
+{
+	if (!bound_try(&q->bound))
+		return 0;
+	lflink(q, pid, ts);
+	return 1;
 }
 
 struct info *
@@ -90,13 +111,17 @@ lfdequeue(struct lfqueue *q)
 #ifdef _VERBOSE
 					printf("Queue is empty\n");
 #endif /* _VERBOSE*/
+					STAT_ADD(STAT_EMPTY, 1);
 					free(result);
 					return NULL;
 				}
-				CAS(&q->Tail, last, next);
+				STAT_ADD(STAT_CAS, 1);
+				if (!CAS(&q->Tail, last, next))
+					STAT_ADD(STAT_CAS_FAILED, 1);
 			} else {
 				result->producerID = next->inf.producerID;
 				result->timestamp = next->inf.timestamp;
+				STAT_ADD(STAT_CAS, 1);
 				if (CAS(&q->Head, first, next)) {
 #ifdef _VERBOSE
 					printf("Dequeue {producerID=%d "
@@ -106,12 +131,53 @@ lfdequeue(struct lfqueue *q)
 #endif /* _VERBOSE*/
 					break;
 				}
+				STAT_ADD(STAT_CAS_FAILED, 1);
 			}
 		}
 	}
+	bound_release(&q->bound);
 	return result;
 }
 
+long
+lfsize(struct lfqueue *q)
+{
+	struct lfqueue_node *first, *last, *next;
+	long n;
+
+	/*
+	 * Nodes are never freed, so they can be followed without
+	 * protection. Once the end of the list is seen, the queue
+	 * held last->seq - first->seq values at that moment if the
+	 * head has not moved since it was read.
+	 */
+	while (1) {
+		first = q->Head;
+		last = q->Tail;
+		while ((next = last->next) != NULL)
+			last = next;
+		n = last->seq - first->seq;
+		if (first == q->Head)
+			return (n > 0) ? n : 0;
+	}
+}
+
+long
+lfsize_approx(struct lfqueue *q)
+{
+	long n;
+
+	n = q->Head->seq;
+	n = q->Tail->seq - n;
+	return (n > 0) ? n : 0;
+}
+
+int
+lfis_empty(struct lfqueue *q)
+{
+	return q->Head->next == NULL;
+}
+
 #ifdef _UTEST
 
 #define NUM_THREADS 3
@@ -159,7 +225,7 @@ int
 main()
 {
 	pthread_t tid[NUM_THREADS];
-	struct lfqueue q;
+	struct lfqueue q, b;
 	struct thrdfuncargs args;
 	int i, e;
 
@@ -189,6 +255,12 @@ main()
 			exit(EXIT_FAILURE);
 		}
 	}
+	printf("size=%ld approx=%ld empty=%d\n", lfsize(&q),
+	    lfsize_approx(&q), lfis_empty(&q));
+	if (lfsize(&q) != NUM_THREADS * NUM_THREADS) {
+		printf("lfsize() is off\n");
+		exit(EXIT_FAILURE);
+	}
 
 	/* Spawn threads to test concurrent dequeues */
 	for (i = 0; i < NUM_THREADS; i++) {
@@ -206,6 +278,31 @@ main()
 			exit(EXIT_FAILURE);
 		}
 	}
+	printf("size=%ld approx=%ld empty=%d\n", lfsize(&q),
+	    lfsize_approx(&q), lfis_empty(&q));
+	if (lfsize(&q) != 0 || !lfis_empty(&q)) {
+		printf("lfsize() is off\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* A bounded queue fails fast once it is full */
+	initlfqueue(&b);
+	setcapacity(&b.bound, NUM_THREADS);
+	for (i = 0; i <= NUM_THREADS; i++) {
+		e = lftry_enqueue(&b, 0, i);
+		printf("lftry_enqueue(%d)=%d\n", i, e);
+		if (e != (i < NUM_THREADS)) {
+			printf("lftry_enqueue() ignores the capacity\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	free(lfdequeue(&b));
+	e = lftry_enqueue(&b, 0, i);
+	printf("lftry_enqueue(%d)=%d\n", i, e);
+	if (e != 1) {
+		printf("lftry_enqueue() does not reuse a freed slot\n");
+		exit(EXIT_FAILURE);
+	}
 
 	return 0;
 }
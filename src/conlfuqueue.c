@@ -0,0 +1,234 @@
+/*
+ * Author: Giannis Giakoumakis
+ * Contact: giannis.m.giakoumakis@gmail.com
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../include/conlfuqueue.h"
+#include "../include/nodealloc.h"
+#include "../include/stats.h"
+
+#define CAS __sync_bool_compare_and_swap
+
+static struct lfuqueue_block *
+allocblock(void)
+{
+	struct lfuqueue_block *b;
+
+	b = node_alloc(sizeof(struct lfuqueue_block));
+	memset(b, 0, sizeof(struct lfuqueue_block));
+	return b;
+}
+
+void
+initlfuqueue(struct lfuqueue *q)
+{
+	q->First = allocblock();
+	q->Head = q->First;
+	q->Tail = q->First;
+}
+
+void
+destroylfuqueue(struct lfuqueue *q)
+{
+	struct lfuqueue_block *b;
+
+	while ((b = q->First) != NULL) {
+		q->First = b->next;
+		node_free(b);
+	}
+	q->Head = NULL;
+	q->Tail = NULL;
+}
+
+void
+lfuenqueue(struct lfuqueue *q, int pid, int ts)
+{
+	struct lfuqueue_block *last, *next, *b;
+	struct lfuqueue_slot *s;
+	int i;
+
+	while (1) {
+		last = q->Tail;
+		i = __atomic_fetch_add(&last->enq, 1, __ATOMIC_RELAXED);
+		if (i < LFUQUEUE_BLOCK) {
+			s = &last->slots[i];
+			s->inf.producerID = pid;
+			s->inf.timestamp = ts;
+			STAT_ADD(STAT_CAS, 1);
+			if (CAS(&s->state, LFUQUEUE_EMPTY, LFUQUEUE_FULL))
+				break;
+			/* a dequeuer gave up on the slot, take another */
+			STAT_ADD(STAT_CAS_FAILED, 1);
+			continue;
+		}
+
+		/* the block is full, append one or help move the tail */
+		if (last != q->Tail)
+			continue;
+		next = last->next;
+		if (next == NULL) {
+			b = allocblock();
+			b->enq = 1;
+			b->slots[0].inf.producerID = pid;
+			b->slots[0].inf.timestamp = ts;
+			b->slots[0].state = LFUQUEUE_FULL;
+			STAT_ADD(STAT_CAS, 2);
+			if (CAS(&last->next, NULL, b)) {
+				if (!CAS(&q->Tail, last, b))
+					STAT_ADD(STAT_CAS_FAILED, 1);
+				break;
+			}
+			/* nobody saw it */
+			STAT_ADD(STAT_CAS_FAILED, 1);
+			node_free(b);
+		} else {
+			STAT_ADD(STAT_CAS, 1);
+			if (!CAS(&q->Tail, last, next))
+				STAT_ADD(STAT_CAS_FAILED, 1);
+		}
+	}
+#ifdef _VERBOSE
+	printf("Enqueue {producerID=%d timestamp=%d} succeeded\n", pid, ts);
+#endif /* _VERBOSE */
+}
+
+int
+lfudequeue(struct lfuqueue *q, struct info *inf)
+{
+	struct lfuqueue_block *first, *next;
+	struct lfuqueue_slot *s;
+	int i;
+
+	while (1) {
+		first = q->Head;
+		/* cheap emptiness test, so an empty queue costs no slot */
+		if (__atomic_load_n(&first->deq, __ATOMIC_RELAXED) >=
+		    __atomic_load_n(&first->enq, __ATOMIC_RELAXED) &&
+		    first->next == NULL)
+			break;
+		i = __atomic_fetch_add(&first->deq, 1, __ATOMIC_RELAXED);
+		if (i < LFUQUEUE_BLOCK) {
+			s = &first->slots[i];
+			if (__atomic_exchange_n(&s->state, LFUQUEUE_TAKEN,
+			    __ATOMIC_ACQ_REL) == LFUQUEUE_FULL) {
+				*inf = s->inf;
+#ifdef _VERBOSE
+				printf("Dequeue {producerID=%d timestamp=%d}"
+				    " succeeded\n", inf->producerID,
+				    inf->timestamp);
+#endif /* _VERBOSE */
+				return 1;
+			}
+			/* its enqueuer has not filled it yet */
+			continue;
+		}
+
+		/* the block is used up, move on to the next one */
+		next = first->next;
+		if (next == NULL)
+			break;
+		STAT_ADD(STAT_CAS, 1);
+		if (!CAS(&q->Head, first, next))
+			STAT_ADD(STAT_CAS_FAILED, 1);
+	}
+	STAT_ADD(STAT_EMPTY, 1);
+	return 0;
+}
+
+#ifdef _UTEST
+
+#define NUM_THREADS 4
+#define NUM_ITEMS (3 * LFUQUEUE_BLOCK + 5)
+
+struct lfuqueue q;
+int done;
+
+void *
+produce(void *arg)
+{
+	int self_id = (int)(long)arg;
+	int i;
+
+	for (i = 0; i < NUM_ITEMS; i++)
+		lfuenqueue(&q, self_id, (i * NUM_THREADS) + self_id);
+	__atomic_add_fetch(&done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/*
+ * Dequeue until the producers are done and the queue is
+ * empty, checking that the items of every producer come out
+ * in order. Return the number of items dequeued.
+ */
+void *
+consume(void *arg)
+{
+	struct info inf;
+	int last[NUM_THREADS];
+	long n = 0;
+	int i, finished;
+
+	for (i = 0; i < NUM_THREADS; i++)
+		last[i] = -1;
+	for (;;) {
+		finished = __atomic_load_n(&done, __ATOMIC_ACQUIRE) ==
+		    NUM_THREADS;
+		if (!lfudequeue(&q, &inf)) {
+			if (finished)
+				break;
+			continue;
+		}
+		if (inf.timestamp <= last[inf.producerID]) {
+			printf("out of order: timestamp=%d after %d\n",
+			    inf.timestamp, last[inf.producerID]);
+			exit(EXIT_FAILURE);
+		}
+		last[inf.producerID] = inf.timestamp;
+		n++;
+	}
+	return (void *)n;
+}
+
+int
+main()
+{
+	pthread_t tid[2 * NUM_THREADS];
+	void *n;
+	long total;
+	int i, e;
+
+	initlfuqueue(&q);
+	printf("This is just a test. An unrolled lock free queue has been"
+	    " initialized.\n");
+
+	/* Spawn producers and consumers that run concurrently */
+	for (i = 0; i < 2 * NUM_THREADS; i++) {
+		e = pthread_create(&tid[i], NULL,
+		    (i < NUM_THREADS) ? produce : consume, (void *)(long)i);
+		if (e != 0) {
+			printf("pthread_create() failed\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	total = 0;
+	for (i = 0; i < 2 * NUM_THREADS; i++) {
+		e = pthread_join(tid[i], &n);
+		if (e != 0) {
+			printf("pthread_join() failed\n");
+			exit(EXIT_FAILURE);
+		}
+		if (i >= NUM_THREADS)
+			total += (long)n;
+	}
+	printf("dequeued %ld of %d items\n", total, NUM_THREADS * NUM_ITEMS);
+	destroylfuqueue(&q);
+
+	return total == NUM_THREADS * NUM_ITEMS ? 0 : EXIT_FAILURE;
+}
+
+#endif /* _UTEST */
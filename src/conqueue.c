@@ -7,19 +7,21 @@
 #include <stdio.h>
 
 #include "../include/conqueue.h"
+#include "../include/nodealloc.h"
+#include "../include/stats.h"
 
 void
 initqueue(struct queue *q)
 {
-	int e;
 	struct queue_node *node;
 
-	node = malloc(sizeof(struct queue_node));
-	if (node == NULL) {
-		printf("malloc() failed\n");
-		exit(EXIT_FAILURE);
-	}
+	node = node_alloc(sizeof(struct queue_node));
+	initqueue_node(q, node);
+}
 
+void
+initqueue_node(struct queue *q, struct queue_node *node)
+{
 	/* Sentinel node values */
 	node->inf.producerID = -1;
 	node->inf.timestamp = -1;
@@ -28,43 +30,76 @@ initqueue(struct queue *q)
 	/* Initialization of the queue */
 	q->Head = node;
 	q->Tail = node;
-	e = pthread_mutex_init(&q->head_lock, NULL);
-	if (e != 0) {
-		printf("pthread_mutex_init() failed\n");
-		exit(EXIT_FAILURE);
-	}
-	e = pthread_mutex_init(&q->tail_lock, NULL);
-	if (e != 0) {
-		printf("pthread_mutex_init() failed\n");
-		exit(EXIT_FAILURE);
-	}
+	initlock(&q->head_lock);
+	initlock(&q->tail_lock);
+	q->enqueued = 0;
+	q->dequeued = 0;
+	initbound(&q->bound, q);
 }
 
-void
-enqueue(struct queue *q, int pid, int ts)
+/* Append a node the bound has made room for */
+static void
+link_node(struct queue *q, struct queue_node *node)
 {
-	struct queue_node *node;
-
-	node = malloc(sizeof(struct queue_node));
-	if (node == NULL) {
-		printf("malloc() failed\n");
-		exit(EXIT_FAILURE);
-	}
-
-	/* Initialize the fields of the new node */
-	node->inf.producerID = pid;
-	node->inf.timestamp = ts;
 	node->next = NULL;
 
 	/* Ensure only one process interacts with the tail */
-	pthread_mutex_lock(&q->tail_lock);
+	STAT_LOCK(&q->tail_lock, STAT_TAIL_LOCKS);
 	q->Tail->next = node;
 	q->Tail = node;
+	/* read by queue_size_approx() without the lock */
+	__atomic_store_n(&q->enqueued, q->enqueued + 1, __ATOMIC_RELAXED);
 #ifdef _VERBOSE
 	printf("Tail={producerID=%d timestamp=%d}\n",
 	    q->Tail->inf.producerID, q->Tail->inf.timestamp);
 #endif /* _VERBOSE */
-	pthread_mutex_unlock(&q->tail_lock);
+	lock_release(&q->tail_lock);
+}
+
+void
+enqueue(struct queue *q, int pid, int ts)
+{
+	struct queue_node *node;
+
+	/* wait for space before allocating, not after */
+	bound_wait(&q->bound);
+	node = node_alloc(sizeof(struct queue_node));
+
+	/* Initialize the fields of the new node */
+	node->inf.producerID = pid;
+	node->inf.timestamp = ts;
+	link_node(q, node);
+}
+
+int
+try_enqueue(struct queue *q, int pid, int ts)
+{
+	struct queue_node *node;
+
+	/* a full queue costs no allocation */
+	if (!bound_try(&q->bound))
+		return 0;
+	node = node_alloc(sizeof(struct queue_node));
+	node->inf.producerID = pid;
+	node->inf.timestamp = ts;
+	link_node(q, node);
+	return 1;
+}
+
+void
+enqueue_node(struct queue *q, struct queue_node *node)
+{
+	bound_wait(&q->bound);
+	link_node(q, node);
+}
+
+int
+try_enqueue_node(struct queue *q, struct queue_node *node)
+{
+	if (!bound_try(&q->bound))
+		return 0;
+	link_node(q, node);
+	return 1;
 }
 
 struct info *
@@ -73,28 +108,88 @@ dequeue(struct queue *q)
 	struct queue_node *tmp;
 	struct info *result = NULL;
 
-	pthread_mutex_lock(&q->head_lock);
-	if (q->Head->next != NULL) {
+	tmp = dequeue_node(q);
+	if (tmp != NULL) {
 		result = malloc(sizeof(struct info));
 		if (result == NULL) {
 			printf("malloc() failed\n");
 			exit(EXIT_FAILURE);	
 		}
-		result->producerID = q->Head->next->inf.producerID;
-		result->timestamp = q->Head->next->inf.timestamp;
+		result->producerID = tmp->inf.producerID;
+		result->timestamp = tmp->inf.timestamp;
+		node_free(tmp);
+	}
+
+	return result;
+}
+
+struct queue_node *
+dequeue_node(struct queue *q)
+{
+	struct queue_node *tmp = NULL;
+
+	STAT_LOCK(&q->head_lock, STAT_HEAD_LOCKS);
+	if (q->Head->next == NULL)
+		STAT_ADD(STAT_EMPTY, 1);
+	else {
+	/*
+	 * The next node becomes the new sentinel, so hand out the
+	 * old sentinel carrying the dequeued value instead. It is
+	 * not the tail, so no enqueuer can touch it.
+	 */
 		tmp = q->Head;
 		q->Head = q->Head->next;
-		free(tmp);
+		tmp->inf.producerID = q->Head->inf.producerID;
+		tmp->inf.timestamp = q->Head->inf.timestamp;
+		__atomic_store_n(&q->dequeued, q->dequeued + 1,
+		    __ATOMIC_RELAXED);
 #ifdef _VERBOSE
 		printf("Result={producerID=%d timestamp=%d}\n",
-		    result->producerID, result->timestamp);
+		    tmp->inf.producerID, tmp->inf.timestamp);
 		printf("Head={producerID=%d timestamp=%d}\n",
 		    q->Head->inf.producerID, q->Head->inf.timestamp);
 #endif /* _VERBOSE */
 	}
-	pthread_mutex_unlock(&q->head_lock);
+	lock_release(&q->head_lock);
+	if (tmp != NULL)
+		bound_release(&q->bound);
 
-	return result;
+	return tmp;
+}
+
+long
+queue_size(struct queue *q)
+{
+	long n;
+
+	lock_acquire(&q->head_lock);
+	lock_acquire(&q->tail_lock);
+	n = q->enqueued - q->dequeued;
+	lock_release(&q->tail_lock);
+	lock_release(&q->head_lock);
+	return n;
+}
+
+long
+queue_size_approx(struct queue *q)
+{
+	long d;
+
+	/* dequeued first, so the difference cannot go negative */
+	d = __atomic_load_n(&q->dequeued, __ATOMIC_RELAXED);
+	return __atomic_load_n(&q->enqueued, __ATOMIC_RELAXED) - d;
+}
+
+int
+queue_is_empty(struct queue *q)
+{
+	int empty;
+
+	/* the head lock keeps the sentinel from being freed */
+	lock_acquire(&q->head_lock);
+	empty = (q->Head->next == NULL);
+	lock_release(&q->head_lock);
+	return empty;
 }
 
 #ifdef _UTEST
@@ -140,11 +235,26 @@ consume(void *arg)
 	}
 }
 
+void
+watermark(void *q, int above, void *arg)
+{
+	printf("watermark: %s\n", above ? "high" : "low");
+}
+
+void *
+enqueue_full(void *arg)
+{
+	/* parks until main dequeues */
+	enqueue((struct queue *)arg, 0, NUM_THREADS);
+	return NULL;
+}
+
 int
 main()
 {
 	pthread_t tid[NUM_THREADS];
-	struct queue q;
+	struct queue q, b;
+	struct info *result;
 	struct producer_attr p_attr;
 	struct consumer_attr c_attr;
 	int i, e;
@@ -175,6 +285,12 @@ main()
 			exit(EXIT_FAILURE);
 		}
 	}
+	printf("size=%ld approx=%ld empty=%d\n", queue_size(&q),
+	    queue_size_approx(&q), queue_is_empty(&q));
+	if (queue_size(&q) != NUM_THREADS * NUM_THREADS) {
+		printf("queue_size() is off\n");
+		exit(EXIT_FAILURE);
+	}
 
 	/* Spawn threads to test concurrent dequeues */
 	c_attr.queue = &q;
@@ -193,6 +309,34 @@ main()
 			exit(EXIT_FAILURE);
 		}
 	}
+	printf("size=%ld approx=%ld empty=%d\n", queue_size(&q),
+	    queue_size_approx(&q), queue_is_empty(&q));
+	if (queue_size(&q) != 0 || !queue_is_empty(&q)) {
+		printf("queue_size() is off\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* A bounded queue fails fast or waits once it is full */
+	initqueue(&b);
+	setcapacity(&b.bound, NUM_THREADS);
+	setwatermarks(&b.bound, NUM_THREADS, 1, watermark, NULL);
+	for (i = 0; i <= NUM_THREADS; i++)
+		printf("try_enqueue(%d)=%d\n", i, try_enqueue(&b, 0, i));
+	e = pthread_create(&tid[0], NULL, enqueue_full, (void *)&b);
+	if (e != 0) {
+		printf("pthread_create() failed\n");
+		exit(EXIT_FAILURE);
+	}
+	free(dequeue(&b));
+	e = pthread_join(tid[0], NULL);
+	if (e != 0) {
+		printf("pthread_join() failed\n");
+		exit(EXIT_FAILURE);
+	}
+	while ((result = dequeue(&b)) != NULL) {
+		printf("dequeued timestamp=%d\n", result->timestamp);
+		free(result);
+	}
 
 	return 0;
 }
@@ -0,0 +1,436 @@
+/*
+ * Author: Giannis Giakoumakis
+ * Contact: giannis.m.giakoumakis@gmail.com
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "../include/constack.h"
+#include "../include/lock.h"
+#include "../include/nodealloc.h"
+#include "../include/stats.h"
+
+#define PTR_BITS 48
+#define PTR_MASK ((UINT64_C(1) << PTR_BITS) - 1)
+
+/* Tagged pointer of a node, with the tag of the word it replaces plus one */
+static inline uint64_t
+tagged(struct queue_node *node, uint64_t old)
+{
+	return (uint64_t)(uintptr_t)node | ((old & ~PTR_MASK) +
+	    (UINT64_C(1) << PTR_BITS));
+}
+
+static inline struct queue_node *
+untagged(uint64_t word)
+{
+	return (struct queue_node *)(uintptr_t)(word & PTR_MASK);
+}
+
+static inline int
+cas(uint64_t *word, uint64_t old, uint64_t new)
+{
+	STAT_ADD(STAT_CAS, 1);
+	if (__atomic_compare_exchange_n(word, &old, new, 0, __ATOMIC_ACQ_REL,
+	    __ATOMIC_RELAXED))
+		return 1;
+	STAT_ADD(STAT_CAS_FAILED, 1);
+	return 0;
+}
+
+/* One attempt to push a node, return 1 on success */
+static int
+try_push(uint64_t *top, struct queue_node *node)
+{
+	uint64_t old;
+
+	old = __atomic_load_n(top, __ATOMIC_RELAXED);
+	node->next = untagged(old);
+	return cas(top, old, tagged(node, old));
+}
+
+/*
+ * One attempt to pop a node. Return 1 on success or if the
+ * stack is empty (*node is then NULL), 0 on a failed CAS.
+ */
+static int
+try_pop(uint64_t *top, struct queue_node **node)
+{
+	uint64_t old;
+
+	old = __atomic_load_n(top, __ATOMIC_ACQUIRE);
+	*node = untagged(old);
+	if (*node == NULL)
+		return 1;
+	/* the node may be popped and reused meanwhile, then the CAS fails */
+	return cas(top, old, tagged((*node)->next, old));
+}
+
+static uint64_t stackids;
+
+/* The nodes the calling thread keeps, of the stack it used last */
+static __thread struct {
+	struct lfstack *s;
+	uint64_t id;
+	struct nodecache *c;
+} mine;
+
+static void
+freenodes(struct queue_node *node)
+{
+	struct queue_node *next;
+
+	for (; node != NULL; node = next) {
+		next = node->next;
+		node_free(node);
+	}
+}
+
+/*
+ * The list of the calling thread on a stack. A thread gets
+ * one on its first push() or pop() and keeps it until the
+ * stack is destroyed; a thread that starts later with the
+ * same id takes over the list of one that exited.
+ */
+static struct nodecache *
+mycache(struct lfstack *s)
+{
+	struct nodecache *c;
+	pthread_t self;
+
+	if (mine.s == s && mine.id == s->id)
+		return mine.c;
+	self = pthread_self();
+	c = __atomic_load_n(&s->caches, __ATOMIC_ACQUIRE);
+	for (; c != NULL; c = c->next)
+		if (pthread_equal(c->owner, self))
+			break;
+	if (c == NULL) {
+		c = aligned_alloc(64, sizeof(struct nodecache));
+		if (c == NULL) {
+			printf("aligned_alloc() failed\n");
+			exit(EXIT_FAILURE);
+		}
+		c->owner = self;
+		c->head = NULL;
+		c->tail = NULL;
+		c->n = 0;
+		c->next = __atomic_load_n(&s->caches, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&s->caches, &c->next, c,
+		    1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			;
+	}
+	mine.s = s;
+	mine.id = s->id;
+	mine.c = c;
+	return c;
+}
+
+/* Keep a popped node, handing the list over once it is full */
+static void
+cache_put(struct lfstack *s, struct queue_node *node)
+{
+	struct nodecache *c = mycache(s);
+	struct queue_node *old;
+
+	if (c->head == NULL)
+		c->tail = node;
+	node->next = c->head;
+	c->head = node;
+	if (++c->n < STACK_CACHE)
+		return;
+	/* pushing a list cannot suffer from ABA, only popping can */
+	old = __atomic_load_n(&s->overflow, __ATOMIC_RELAXED);
+	do {
+		c->tail->next = old;
+	} while (!__atomic_compare_exchange_n(&s->overflow, &old, c->head,
+	    1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	c->head = NULL;
+	c->tail = NULL;
+	c->n = 0;
+}
+
+/* A node to reuse, NULL if there is none */
+static struct queue_node *
+cache_get(struct lfstack *s)
+{
+	struct nodecache *c = mycache(s);
+	struct queue_node *node;
+
+	if (c->head == NULL &&
+	    __atomic_load_n(&s->overflow, __ATOMIC_RELAXED) != NULL) {
+		/* take the whole list, it is ours to walk afterwards */
+		node = __atomic_exchange_n(&s->overflow, NULL,
+		    __ATOMIC_ACQUIRE);
+		if (node == NULL)
+			return NULL;
+		c->head = node;
+		for (c->n = 1; node->next != NULL; c->n++)
+			node = node->next;
+		c->tail = node;
+	}
+	node = c->head;
+	if (node == NULL)
+		return NULL;
+	c->head = node->next;
+	if (--c->n == 0)
+		c->tail = NULL;
+	return node;
+}
+
+/* A slot of the elimination array, picked at random per call */
+static uint64_t *
+slot(struct lfstack *s)
+{
+	static __thread unsigned int seed;
+
+	if (seed == 0)
+		seed = (unsigned int)(uintptr_t)&seed | 1;
+	/* xorshift */
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return &s->elim[seed % STACK_ELIM].word;
+}
+
+/*
+ * Offer a node in the elimination array for a while. Return
+ * 1 if a pop took it, 0 if the push has to be retried.
+ */
+static int
+eliminate_push(struct lfstack *s, struct queue_node *node)
+{
+	uint64_t *word, old, mine;
+	int i;
+
+	word = slot(s);
+	old = __atomic_load_n(word, __ATOMIC_RELAXED);
+	if (untagged(old) != NULL)
+		return 0;
+	mine = tagged(node, old);
+	if (!cas(word, old, mine))
+		return 0;
+	for (i = 0; i < STACK_ELIM_SPINS; i++) {
+		if (__atomic_load_n(word, __ATOMIC_RELAXED) != mine)
+			goto taken;
+		cpu_relax();
+	}
+	/* nobody came, take the node back unless a pop just did */
+	if (cas(word, mine, tagged(NULL, mine)))
+		return 0;
+taken:
+	STAT_ADD(STAT_ELIMINATED, 1);
+	return 1;
+}
+
+/* Take a node offered in the elimination array, if any */
+static struct queue_node *
+eliminate_pop(struct lfstack *s)
+{
+	struct queue_node *node;
+	uint64_t *word, old;
+
+	word = slot(s);
+	old = __atomic_load_n(word, __ATOMIC_ACQUIRE);
+	node = untagged(old);
+	if (node == NULL || !cas(word, old, tagged(NULL, old)))
+		return NULL;
+	return node;
+}
+
+void
+initstack(struct lfstack *s)
+{
+	int i;
+
+	s->top = 0;
+	s->overflow = NULL;
+	s->caches = NULL;
+	/* tells a thread its list is of an older stack at this address */
+	s->id = __atomic_add_fetch(&stackids, 1, __ATOMIC_RELAXED);
+	for (i = 0; i < STACK_ELIM; i++)
+		s->elim[i].word = 0;
+}
+
+void
+destroystack(struct lfstack *s)
+{
+	struct nodecache *c, *next;
+
+	freenodes(untagged(s->top));
+	freenodes(s->overflow);
+	for (c = s->caches; c != NULL; c = next) {
+		next = c->next;
+		freenodes(c->head);
+		free(c);
+	}
+	s->top = 0;
+	s->overflow = NULL;
+	s->caches = NULL;
+}
+
+void
+push_node(struct lfstack *s, struct queue_node *node)
+{
+	if ((uintptr_t)node & ~PTR_MASK) {
+		printf("push_node(): %p does not fit in %d bits\n",
+		    (void *)node, PTR_BITS);
+		exit(EXIT_FAILURE);
+	}
+	while (!try_push(&s->top, node) && !eliminate_push(s, node))
+		;
+}
+
+struct queue_node *
+pop_node(struct lfstack *s)
+{
+	struct queue_node *node;
+
+	while (!try_pop(&s->top, &node))
+		if ((node = eliminate_pop(s)) != NULL)
+			break;
+	return node;
+}
+
+void
+push(struct lfstack *s, int pid, int ts)
+{
+	struct queue_node *node;
+
+	node = cache_get(s);
+	if (node == NULL)
+		node = node_alloc(sizeof(struct queue_node));
+	node->inf.producerID = pid;
+	node->inf.timestamp = ts;
+	push_node(s, node);
+#ifdef _VERBOSE
+	printf("Push {producerID=%d timestamp=%d} succeeded\n", pid, ts);
+#endif /* _VERBOSE */
+}
+
+int
+pop(struct lfstack *s, struct info *inf)
+{
+	struct queue_node *node;
+
+	node = pop_node(s);
+	if (node == NULL) {
+		STAT_ADD(STAT_EMPTY, 1);
+		return 0;
+	}
+	*inf = node->inf;
+	cache_put(s, node);
+#ifdef _VERBOSE
+	printf("Pop {producerID=%d timestamp=%d} succeeded\n",
+	    inf->producerID, inf->timestamp);
+#endif /* _VERBOSE */
+	return 1;
+}
+
+#ifdef _UTEST
+
+#define NUM_THREADS 4
+#define NUM_ITEMS 10000
+
+struct lfstack s;
+char seen[NUM_THREADS * NUM_ITEMS];
+int done;
+
+void *
+produce(void *arg)
+{
+	int self_id = (int)(long)arg;
+	int i;
+
+	for (i = 0; i < NUM_ITEMS; i++)
+		push(&s, self_id, (i * NUM_THREADS) + self_id);
+	__atomic_add_fetch(&done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/*
+ * Pop until the pushers are done and the stack is empty,
+ * checking that no value comes out twice. Return the number
+ * of values popped.
+ */
+void *
+consume(void *arg)
+{
+	struct info inf;
+	long n = 0;
+	int finished;
+
+	for (;;) {
+		finished = __atomic_load_n(&done, __ATOMIC_ACQUIRE) ==
+		    NUM_THREADS;
+		if (!pop(&s, &inf)) {
+			if (finished)
+				break;
+			continue;
+		}
+		if (__atomic_exchange_n(&seen[inf.timestamp], 1,
+		    __ATOMIC_RELAXED)) {
+			printf("timestamp=%d popped twice\n", inf.timestamp);
+			exit(EXIT_FAILURE);
+		}
+		n++;
+	}
+	return (void *)n;
+}
+
+int
+main()
+{
+	pthread_t tid[2 * NUM_THREADS];
+	struct info inf;
+	void *n;
+	long total;
+	int i, e;
+
+	initstack(&s);
+	printf("This is just a test. A lock free stack has been"
+	    " initialized.\n");
+
+	/* A single thread sees the values in reverse */
+	for (i = 0; i < 5; i++)
+		push(&s, 0, i);
+	for (i = 4; i >= 0; i--) {
+		if (!pop(&s, &inf) || inf.timestamp != i) {
+			printf("pop() did not return timestamp=%d\n", i);
+			exit(EXIT_FAILURE);
+		}
+		printf("popped timestamp=%d\n", inf.timestamp);
+	}
+	if (pop(&s, &inf)) {
+		printf("pop() on an empty stack succeeded\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* Spawn pushers and poppers that run concurrently */
+	for (i = 0; i < 2 * NUM_THREADS; i++) {
+		e = pthread_create(&tid[i], NULL,
+		    (i < NUM_THREADS) ? produce : consume, (void *)(long)i);
+		if (e != 0) {
+			printf("pthread_create() failed\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	total = 0;
+	for (i = 0; i < 2 * NUM_THREADS; i++) {
+		e = pthread_join(tid[i], &n);
+		if (e != 0) {
+			printf("pthread_join() failed\n");
+			exit(EXIT_FAILURE);
+		}
+		if (i >= NUM_THREADS)
+			total += (long)n;
+	}
+	printf("popped %ld of %d values\n", total, NUM_THREADS * NUM_ITEMS);
+	destroystack(&s);
+
+	return total == NUM_THREADS * NUM_ITEMS ? 0 : EXIT_FAILURE;
+}
+
+#endif /* _UTEST */
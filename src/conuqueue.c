@@ -0,0 +1,210 @@
+/*
+ * Author: Giannis Giakoumakis
+ * Contact: giannis.m.giakoumakis@gmail.com
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../include/conuqueue.h"
+#include "../include/nodealloc.h"
+#include "../include/stats.h"
+
+static struct uqueue_block *
+allocblock(void)
+{
+	struct uqueue_block *b;
+
+	b = node_alloc(sizeof(struct uqueue_block));
+	memset(b->ready, 0, sizeof(b->ready));
+	b->next = NULL;
+	return b;
+}
+
+void
+inituqueue(struct uqueue *q)
+{
+	q->Head = allocblock();
+	q->head_slot = 0;
+	initlock(&q->head_lock);
+	q->Tail = q->Head;
+	q->tail_slot = 0;
+	initlock(&q->tail_lock);
+}
+
+void
+destroyuqueue(struct uqueue *q)
+{
+	struct uqueue_block *b;
+
+	while ((b = q->Head) != NULL) {
+		q->Head = b->next;
+		node_free(b);
+	}
+	destroylock(&q->head_lock);
+	destroylock(&q->tail_lock);
+}
+
+void
+uenqueue(struct uqueue *q, int pid, int ts)
+{
+	struct uqueue_block *b;
+	int i;
+
+	STAT_LOCK(&q->tail_lock, STAT_TAIL_LOCKS);
+	if (q->tail_slot == UQUEUE_BLOCK) {
+		/* every slot of the tail block is taken, link a new one */
+		b = allocblock();
+		__atomic_store_n(&q->Tail->next, b, __ATOMIC_RELEASE);
+		q->Tail = b;
+		q->tail_slot = 0;
+	}
+	b = q->Tail;
+	i = q->tail_slot++;
+	b->items[i].producerID = pid;
+	b->items[i].timestamp = ts;
+	/* publish the slot to the dequeuers */
+	__atomic_store_n(&b->ready[i], 1, __ATOMIC_RELEASE);
+#ifdef _VERBOSE
+	printf("Tail={producerID=%d timestamp=%d}\n", pid, ts);
+#endif /* _VERBOSE */
+	lock_release(&q->tail_lock);
+}
+
+int
+udequeue(struct uqueue *q, struct info *inf)
+{
+	struct uqueue_block *b, *old = NULL;
+	int i;
+
+	STAT_LOCK(&q->head_lock, STAT_HEAD_LOCKS);
+	b = q->Head;
+	if (q->head_slot == UQUEUE_BLOCK) {
+		/*
+		 * The head block is used up. Once it has a successor no
+		 * enqueuer writes to it anymore, so it can be freed.
+		 */
+		old = b;
+		b = __atomic_load_n(&old->next, __ATOMIC_ACQUIRE);
+		if (b == NULL) {
+			lock_release(&q->head_lock);
+			STAT_ADD(STAT_EMPTY, 1);
+			return 0;
+		}
+		q->Head = b;
+		q->head_slot = 0;
+	}
+	i = q->head_slot;
+	if (!__atomic_load_n(&b->ready[i], __ATOMIC_ACQUIRE)) {
+		lock_release(&q->head_lock);
+		if (old != NULL)
+			node_free(old);
+		STAT_ADD(STAT_EMPTY, 1);
+		return 0;
+	}
+	*inf = b->items[i];
+	q->head_slot++;
+#ifdef _VERBOSE
+	printf("Result={producerID=%d timestamp=%d}\n",
+	    inf->producerID, inf->timestamp);
+#endif /* _VERBOSE */
+	lock_release(&q->head_lock);
+	if (old != NULL)
+		node_free(old);
+
+	return 1;
+}
+
+#ifdef _UTEST
+
+#define NUM_THREADS 4
+#define NUM_ITEMS (3 * UQUEUE_BLOCK + 5)
+
+struct uqueue q;
+int done;
+
+void *
+produce(void *arg)
+{
+	int self_id = (int)(long)arg;
+	int i;
+
+	for (i = 0; i < NUM_ITEMS; i++)
+		uenqueue(&q, self_id, (i * NUM_THREADS) + self_id);
+	__atomic_add_fetch(&done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/*
+ * Dequeue until the producers are done and the queue is
+ * empty, checking that the items of every producer come out
+ * in order. Return the number of items dequeued.
+ */
+void *
+consume(void *arg)
+{
+	struct info inf;
+	int last[NUM_THREADS];
+	long n = 0;
+	int i, finished;
+
+	for (i = 0; i < NUM_THREADS; i++)
+		last[i] = -1;
+	for (;;) {
+		finished = __atomic_load_n(&done, __ATOMIC_ACQUIRE) ==
+		    NUM_THREADS;
+		if (!udequeue(&q, &inf)) {
+			if (finished)
+				break;
+			continue;
+		}
+		if (inf.timestamp <= last[inf.producerID]) {
+			printf("out of order: timestamp=%d after %d\n",
+			    inf.timestamp, last[inf.producerID]);
+			exit(EXIT_FAILURE);
+		}
+		last[inf.producerID] = inf.timestamp;
+		n++;
+	}
+	return (void *)n;
+}
+
+int
+main()
+{
+	pthread_t tid[2 * NUM_THREADS];
+	void *n;
+	long total;
+	int i, e;
+
+	inituqueue(&q);
+	printf("This is just a test. An unrolled queue has been"
+	    " initialized.\n");
+
+	/* Spawn producers and consumers that run concurrently */
+	for (i = 0; i < 2 * NUM_THREADS; i++) {
+		e = pthread_create(&tid[i], NULL,
+		    (i < NUM_THREADS) ? produce : consume, (void *)(long)i);
+		if (e != 0) {
+			printf("pthread_create() failed\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	total = 0;
+	for (i = 0; i < 2 * NUM_THREADS; i++) {
+		e = pthread_join(tid[i], &n);
+		if (e != 0) {
+			printf("pthread_join() failed\n");
+			exit(EXIT_FAILURE);
+		}
+		if (i >= NUM_THREADS)
+			total += (long)n;
+	}
+	printf("dequeued %ld of %d items\n", total, NUM_THREADS * NUM_ITEMS);
+	destroyuqueue(&q);
+
+	return total == NUM_THREADS * NUM_ITEMS ? 0 : EXIT_FAILURE;
+}
+
+#endif /* _UTEST */
@@ -0,0 +1,37 @@
+/*
+ * Author: Giannis Giakoumakis
+ * Contact: giannis.m.giakoumakis@gmail.com
+ */
+
+#include "../include/counter.h"
+
+__thread int myshard = -1;
+
+static int nextshard = 0;
+
+void
+initcounter(struct counter *c)
+{
+	int i;
+
+	for (i = 0; i < COUNTER_SHARDS; i++)
+		c->shard[i].n = 0;
+}
+
+void
+counter_register(void)
+{
+	myshard = __atomic_fetch_add(&nextshard, 1, __ATOMIC_RELAXED) %
+	    COUNTER_SHARDS;
+}
+
+long
+counter_read(struct counter *c)
+{
+	long sum = 0;
+	int i;
+
+	for (i = 0; i < COUNTER_SHARDS; i++)
+		sum += __atomic_load_n(&c->shard[i].n, __ATOMIC_RELAXED);
+	return sum;
+}
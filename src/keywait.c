@@ -0,0 +1,81 @@
+/*
+ * Author: Giannis Giakoumakis
+ * Contact: giannis.m.giakoumakis@gmail.com
+ */
+
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "../include/keywait.h"
+#include "../include/measure.h"
+
+int keywaiters;
+
+static struct keywait_bucket table[KEYWAIT_BUCKETS]
+    __attribute__((aligned(64)));
+
+static struct keywait_bucket *
+bucket(const void *obj, int key)
+{
+	uint64_t h;
+
+	/* consecutive keys of one structure land in different buckets */
+	h = ((uint64_t)(uintptr_t)obj >> 6) ^ (uint32_t)key;
+	h *= 0x9E3779B97F4A7C15ULL;
+	return &table[h >> (64 - KEYWAIT_BITS)];
+}
+
+void
+keywait_begin(struct keywait *w, const void *obj, int key)
+{
+	w->b = bucket(obj, key);
+	__atomic_add_fetch(&w->b->waiters, 1, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&keywaiters, 1, __ATOMIC_SEQ_CST);
+	w->seq = __atomic_load_n(&w->b->seq, __ATOMIC_SEQ_CST);
+}
+
+int
+keywait_sleep(struct keywait *w, uint64_t deadline)
+{
+	struct timespec ts, *tp;
+	uint64_t now, left;
+
+	tp = NULL;
+	if (deadline != 0) {
+		now = now_ns();
+		if (now >= deadline)
+			return 0;
+		left = deadline - now;
+		ts.tv_sec = (time_t)(left / 1000000000);
+		ts.tv_nsec = (long)(left % 1000000000);
+		tp = &ts;
+	}
+	/* returns at once if the sequence moved since the last look */
+	syscall(SYS_futex, &w->b->seq, FUTEX_WAIT_PRIVATE, w->seq, tp, NULL,
+	    0);
+	w->seq = __atomic_load_n(&w->b->seq, __ATOMIC_SEQ_CST);
+	return deadline == 0 || now_ns() < deadline;
+}
+
+void
+keywait_end(struct keywait *w)
+{
+	__atomic_sub_fetch(&keywaiters, 1, __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&w->b->waiters, 1, __ATOMIC_RELAXED);
+}
+
+void
+keywait_wakeup(const void *obj, int key)
+{
+	struct keywait_bucket *b;
+
+	b = bucket(obj, key);
+	if (__atomic_load_n(&b->waiters, __ATOMIC_SEQ_CST) == 0)
+		return;
+	__atomic_add_fetch(&b->seq, 1, __ATOMIC_SEQ_CST);
+	syscall(SYS_futex, &b->seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL,
+	    0);
+}
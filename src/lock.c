@@ -0,0 +1,227 @@
+/*
+ * Author: Giannis Giakoumakis
+ * Contact: giannis.m.giakoumakis@gmail.com
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "../include/lock.h"
+
+#if defined(_LOCK_TICKET)
+
+void
+initlock(struct lock *l)
+{
+	l->next = 0;
+	l->owner = 0;
+}
+
+void
+destroylock(struct lock *l)
+{
+}
+
+int
+lock_try(struct lock *l)
+{
+	unsigned int owner;
+
+	owner = __atomic_load_n(&l->owner, __ATOMIC_RELAXED);
+	return __atomic_compare_exchange_n(&l->next, &owner, owner + 1, 0,
+	    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+#elif defined(_LOCK_MCS) || defined(_LOCK_CLH)
+
+/*
+ * Free queue nodes of the calling thread, freed when it
+ * exits. Nodes move between pools (a CLH node is recycled
+ * by the successor of its owner), which is fine as long as
+ * one thread at a time can see them. A thread that only
+ * takes over nodes, e.g. a consumer behind producers on
+ * another lock, frees those beyond LOCK_POOL_MAX.
+ */
+static __thread struct lock_qnode *pool;
+static __thread int npool;
+static pthread_key_t poolkey;
+static pthread_once_t poolonce = PTHREAD_ONCE_INIT;
+
+static void
+freepool(void *arg)
+{
+	struct lock_qnode **head = arg;
+	struct lock_qnode *n;
+
+	while ((n = *head) != NULL) {
+		*head = n->next;
+		free(n);
+	}
+	npool = 0;
+}
+
+static void
+makepoolkey(void)
+{
+	if (pthread_key_create(&poolkey, freepool) != 0) {
+		printf("pthread_key_create() failed\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+struct lock_qnode *
+lock_qnode_get(void)
+{
+	struct lock_qnode *n;
+
+	n = pool;
+	if (n != NULL) {
+		pool = n->next;
+		npool--;
+		return n;
+	}
+	pthread_once(&poolonce, makepoolkey);
+	if (pthread_getspecific(poolkey) == NULL)
+		pthread_setspecific(poolkey, &pool);
+	n = aligned_alloc(64, sizeof(struct lock_qnode));
+	if (n == NULL) {
+		printf("malloc() failed\n");
+		exit(EXIT_FAILURE);
+	}
+	return n;
+}
+
+void
+lock_qnode_put(struct lock_qnode *n)
+{
+	if (npool == LOCK_POOL_MAX) {
+		free(n);
+		return;
+	}
+	n->next = pool;
+	pool = n;
+	npool++;
+}
+
+void
+initlock(struct lock *l)
+{
+	l->tail = NULL;
+	l->holder = NULL;
+}
+
+void
+destroylock(struct lock *l)
+{
+}
+
+int
+lock_try(struct lock *l)
+{
+	struct lock_qnode *n, *expected;
+
+	n = lock_qnode_get();
+	n->next = NULL;
+	n->locked = 1;
+	expected = NULL;
+	if (!__atomic_compare_exchange_n(&l->tail, &expected, n, 0,
+	    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+		lock_qnode_put(n);
+		return 0;
+	}
+	l->holder = n;
+	return 1;
+}
+
+#elif defined(_LOCK_ADAPTIVE)
+
+void
+initlock(struct lock *l)
+{
+	l->state = 0;
+	l->spins = 0;
+}
+
+void
+destroylock(struct lock *l)
+{
+}
+
+int
+lock_try(struct lock *l)
+{
+	int free = 0;
+
+	return __atomic_compare_exchange_n(&l->state, &free, 1, 0,
+	    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+/*
+ * Slow path of lock_acquire(). Spin for up to twice the
+ * spins that got the lock lately (as glibc's adaptive
+ * mutexes do), then sleep in the kernel until the holder
+ * wakes us up. State 2 tells the holder someone may sleep.
+ */
+void
+lock_park(struct lock *l)
+{
+	int max, spins, n, free;
+
+	spins = __atomic_load_n(&l->spins, __ATOMIC_RELAXED);
+	max = 2 * spins + 10;
+	if (max > LOCK_SPINS)
+		max = LOCK_SPINS;
+	for (n = 0; n < max; n++) {
+		cpu_relax();
+		free = 0;
+		if (__atomic_load_n(&l->state, __ATOMIC_RELAXED) == 0 &&
+		    __atomic_compare_exchange_n(&l->state, &free, 1, 0,
+		    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			__atomic_store_n(&l->spins, spins + (n - spins) / 8,
+			    __ATOMIC_RELAXED);
+			return;
+		}
+	}
+	__atomic_store_n(&l->spins, spins + (max - spins) / 8,
+	    __ATOMIC_RELAXED);
+	while (__atomic_exchange_n(&l->state, 2, __ATOMIC_ACQUIRE) != 0)
+		syscall(SYS_futex, &l->state, FUTEX_WAIT_PRIVATE, 2, NULL,
+		    NULL, 0);
+}
+
+void
+lock_unpark(struct lock *l)
+{
+	syscall(SYS_futex, &l->state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+#else /* mutex */
+
+void
+initlock(struct lock *l)
+{
+	int e;
+
+	e = pthread_mutex_init(&l->m, NULL);
+	if (e != 0) {
+		printf("pthread_mutex_init() failed\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+void
+destroylock(struct lock *l)
+{
+	pthread_mutex_destroy(&l->m);
+}
+
+int
+lock_try(struct lock *l)
+{
+	return pthread_mutex_trylock(&l->m) == 0;
+}
+
+#endif
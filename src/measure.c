@@ -0,0 +1,93 @@
+/*
+ * Author: Giannis Giakoumakis
+ * Contact: giannis.m.giakoumakis@gmail.com
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../include/measure.h"
+
+uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void
+initlatency(struct latency *l)
+{
+	l->counts = calloc(LATENCY_BUCKETS, sizeof(uint64_t));
+	if (l->counts == NULL) {
+		printf("malloc() failed\n");
+		exit(EXIT_FAILURE);
+	}
+	l->n = 0;
+	l->max = 0;
+}
+
+void
+latency_merge(struct latency *dst, struct latency *src)
+{
+	int i;
+
+	for (i = 0; i < LATENCY_BUCKETS; i++)
+		dst->counts[i] += src->counts[i];
+	dst->n += src->n;
+	if (src->max > dst->max)
+		dst->max = src->max;
+}
+
+/* Largest value that falls into bucket i */
+static uint64_t
+bucket_top(int i)
+{
+	int shift;
+
+	if (i < LATENCY_SUB)
+		return (uint64_t)i;
+	shift = (i - LATENCY_SUB) / (LATENCY_SUB / 2) + 1;
+	return (((uint64_t)((i - LATENCY_SUB) % (LATENCY_SUB / 2) +
+	    LATENCY_SUB / 2 + 1)) << shift) - 1;
+}
+
+uint64_t
+latency_percentile(struct latency *l, double p)
+{
+	uint64_t rank, seen, top;
+	int i;
+
+	if (l->n == 0)
+		return 0;
+
+	/* nearest rank, ceil(p / 100 * n) */
+	rank = (uint64_t)(p / 100.0 * l->n);
+	if (rank < p / 100.0 * l->n)
+		rank++;
+	if (rank < 1)
+		rank = 1;
+	if (rank > l->n)
+		rank = l->n;
+
+	seen = 0;
+	for (i = 0; i < LATENCY_BUCKETS; i++) {
+		seen += l->counts[i];
+		if (seen >= rank)
+			break;
+	}
+	top = bucket_top(i);
+	return (top < l->max) ? top : l->max;
+}
+
+void
+latency_free(struct latency *l)
+{
+	free(l->counts);
+	l->counts = NULL;
+	l->n = 0;
+	l->max = 0;
+}
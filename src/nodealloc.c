@@ -0,0 +1,494 @@
+/*
+ * Author: Giannis Giakoumakis
+ * Contact: giannis.m.giakoumakis@gmail.com
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "../include/nodealloc.h"
+
+/* Counted operations between two lookups of the NUMA node */
+#define NODE_REFRESH 256
+
+/*
+ * Counters of one thread. Only the owner writes them, so
+ * allocating and freeing touch no shared cache line, and
+ * readers add up every thread. Blocks are cache line
+ * aligned so two threads never share a line. A thread that
+ * exits folds its counts into the retired ones and leaves its
+ * block to the next thread.
+ */
+struct threadcounters {
+	long allocs[NODEALLOC_MAXNODES];
+	long frees[NODEALLOC_MAXNODES];
+	struct threadcounters *next;
+} __attribute__((aligned(64)));
+
+static pthread_mutex_t counterlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t counteronce = PTHREAD_ONCE_INIT;
+static pthread_key_t counterkey;
+static struct threadcounters *live;
+static struct threadcounters *spare;
+static struct threadcounters retired;
+
+static __thread struct threadcounters *mycounters;
+static __thread int mynode;
+static __thread int mycalls; /* until the next node lookup */
+
+static inline int
+slot(int node)
+{
+	if (node < 0)
+		return 0;
+	return (node < NODEALLOC_MAXNODES) ? node : NODEALLOC_MAXNODES - 1;
+}
+
+static void
+retire(void *arg)
+{
+	struct threadcounters *c = arg, **pp;
+	int i;
+
+	pthread_mutex_lock(&counterlock);
+	for (i = 0; i < NODEALLOC_MAXNODES; i++) {
+		retired.allocs[i] += c->allocs[i];
+		retired.frees[i] += c->frees[i];
+	}
+	for (pp = &live; *pp != c; pp = &(*pp)->next)
+		;
+	*pp = c->next;
+	c->next = spare;
+	spare = c;
+	pthread_mutex_unlock(&counterlock);
+	/* a later destructor that frees nodes registers a new block */
+	mycounters = NULL;
+}
+
+static void
+makekey(void)
+{
+	if (pthread_key_create(&counterkey, retire) != 0) {
+		printf("pthread_key_create() failed\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* Counters of the calling thread, registered on first use */
+static struct threadcounters *
+threadcounters(void)
+{
+	struct threadcounters *c;
+
+	pthread_once(&counteronce, makekey);
+	pthread_mutex_lock(&counterlock);
+	c = spare;
+	if (c != NULL)
+		spare = c->next;
+	else {
+		c = aligned_alloc(64, sizeof(struct threadcounters));
+		if (c == NULL) {
+			printf("aligned_alloc() failed\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	memset(c->allocs, 0, sizeof(c->allocs));
+	memset(c->frees, 0, sizeof(c->frees));
+	c->next = live;
+	live = c;
+	pthread_mutex_unlock(&counterlock);
+	pthread_setspecific(counterkey, c);
+	mycounters = c;
+	return c;
+}
+
+/*
+ * Count an allocation or a free on the NUMA node of the
+ * calling thread. The node is looked up every NODE_REFRESH
+ * calls only, so a thread that migrates is counted on its
+ * old node for a while.
+ */
+static inline void
+count(int isfree)
+{
+	struct threadcounters *c;
+	long *v;
+
+	c = (mycounters != NULL) ? mycounters : threadcounters();
+	if (--mycalls < 0) {
+		mynode = slot(current_node());
+		mycalls = NODE_REFRESH;
+	}
+	v = isfree ? &c->frees[mynode] : &c->allocs[mynode];
+	/* a plain increment, made whole for concurrent readers */
+	__atomic_store_n(v, *v + 1, __ATOMIC_RELAXED);
+}
+
+/* Size and alignment of an arena chunk, that of a huge page */
+#define CHUNK_SIZE (2UL << 20)
+
+/* Size classes of the arena, NODEALLOC_ARENA_MAX in steps of GRAIN */
+#define GRAIN 16
+#define NCLASSES (NODEALLOC_ARENA_MAX / GRAIN)
+
+/* Free nodes a thread keeps per class before passing them on */
+#define BATCH 256
+
+/* Start of a chunk, its nodes follow on the next cache line */
+struct chunk {
+	struct chunk *next;
+	int class;
+};
+
+#define CHUNK_HEADER 64
+
+/*
+ * A free node. A batch passed on is a list of BATCH nodes,
+ * linked to the next batch through its first node.
+ */
+struct freenode {
+	struct freenode *next;
+	struct freenode *nextbatch;
+};
+
+/* What a thread allocates nodes of a class from */
+struct cache {
+	char *bump; /* next node never handed out */
+	char *end; /* of the chunk bump is in */
+	struct freenode *free;
+	int nfree;
+};
+
+static enum nodealloc_kind kind = NODEALLOC_MALLOC;
+
+/* Bumped by nodealloc_release(), thread caches older than it are void */
+static unsigned long generation = 1;
+
+static __thread struct cache caches[NCLASSES];
+static __thread unsigned long cachegen;
+
+/* Every chunk mapped, and batches of free nodes, by class */
+static pthread_mutex_t arenalock = PTHREAD_MUTEX_INITIALIZER;
+static struct chunk *chunks;
+static struct freenode *batches[NCLASSES];
+static struct arenastats arenastats;
+
+/*
+ * Map a chunk. Huge pages have to be reserved by the
+ * administrator for MAP_HUGETLB to succeed, so without them
+ * map twice the size, keep the aligned half and ask for
+ * transparent huge pages, which the kernel may or may not
+ * provide (see /sys/kernel/mm/transparent_hugepage).
+ */
+static struct chunk *
+newchunk(int class)
+{
+	struct chunk *c;
+	char *p, *a;
+
+	p = mmap(NULL, CHUNK_SIZE, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (p != MAP_FAILED) {
+		a = p;
+		__atomic_fetch_add(&arenastats.huge, 1, __ATOMIC_RELAXED);
+	} else {
+		p = mmap(NULL, 2 * CHUNK_SIZE, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED) {
+			printf("mmap() failed\n");
+			exit(EXIT_FAILURE);
+		}
+		a = (char *)(((uintptr_t)p + CHUNK_SIZE - 1) &
+		    ~(CHUNK_SIZE - 1));
+		if (a > p)
+			munmap(p, a - p);
+		if (a + CHUNK_SIZE < p + 2 * CHUNK_SIZE)
+			munmap(a + CHUNK_SIZE, p + 2 * CHUNK_SIZE -
+			    (a + CHUNK_SIZE));
+		if (madvise(a, CHUNK_SIZE, MADV_HUGEPAGE) == 0)
+			__atomic_fetch_add(&arenastats.transparent, 1,
+			    __ATOMIC_RELAXED);
+		else
+			__atomic_fetch_add(&arenastats.small, 1,
+			    __ATOMIC_RELAXED);
+	}
+	c = (struct chunk *)a;
+	c->class = class;
+	pthread_mutex_lock(&arenalock);
+	c->next = chunks;
+	chunks = c;
+	pthread_mutex_unlock(&arenalock);
+	return c;
+}
+
+static void *
+arena_alloc(size_t size)
+{
+	struct freenode *n;
+	struct cache *c;
+	struct chunk *ch;
+	size_t sz;
+	int class;
+
+	if (size > NODEALLOC_ARENA_MAX) {
+		printf("node_alloc(): %zu bytes is more than the arena"
+		    " serves\n", size);
+		exit(EXIT_FAILURE);
+	}
+	class = (size > 0) ? (size - 1) / GRAIN : 0;
+	sz = (size_t)(class + 1) * GRAIN;
+	if (cachegen != __atomic_load_n(&generation, __ATOMIC_ACQUIRE)) {
+		memset(caches, 0, sizeof(caches));
+		cachegen = generation;
+	}
+	c = &caches[class];
+
+	/* a freed node first, the latest one is likely cached */
+	if (c->free == NULL && __atomic_load_n(&batches[class],
+	    __ATOMIC_RELAXED) != NULL) {
+		pthread_mutex_lock(&arenalock);
+		if ((n = batches[class]) != NULL) {
+			batches[class] = n->nextbatch;
+			c->free = n;
+			c->nfree = BATCH;
+		}
+		pthread_mutex_unlock(&arenalock);
+	}
+	if ((n = c->free) != NULL) {
+		c->free = n->next;
+		c->nfree--;
+		return n;
+	}
+
+	if (c->bump == NULL || c->bump + sz > c->end) {
+		ch = newchunk(class);
+		c->bump = (char *)ch + CHUNK_HEADER;
+		c->end = (char *)ch + CHUNK_SIZE;
+	}
+	n = (struct freenode *)c->bump;
+	c->bump += sz;
+	return n;
+}
+
+static void
+arena_free(void *p)
+{
+	struct freenode *n = p;
+	struct cache *c;
+	int class;
+
+	if (cachegen != __atomic_load_n(&generation, __ATOMIC_ACQUIRE)) {
+		memset(caches, 0, sizeof(caches));
+		cachegen = generation;
+	}
+	/* chunks are aligned to their size, the header tells the class */
+	class = ((struct chunk *)((uintptr_t)p & ~(CHUNK_SIZE - 1)))->class;
+	c = &caches[class];
+	if (c->nfree == BATCH) {
+		/* a thread that only frees hands its nodes to the rest */
+		pthread_mutex_lock(&arenalock);
+		c->free->nextbatch = batches[class];
+		batches[class] = c->free;
+		pthread_mutex_unlock(&arenalock);
+		c->free = NULL;
+		c->nfree = 0;
+	}
+	n->next = c->free;
+	c->free = n;
+	c->nfree++;
+}
+
+/*
+ * glibc gives every thread an arena of its own, and fresh
+ * pages of an arena are placed on the node of the thread that
+ * touches them first, i.e. the allocating thread, which fills
+ * the node in right away. Nothing binds the memory though: a
+ * recycled chunk keeps the node of whoever touched its page
+ * first, and a thread that migrated meanwhile gets memory of
+ * its old node. A chunk of the arena allocator is filled by
+ * one thread as well, but a freed node is reused by the
+ * freeing thread or whoever takes its batch.
+ */
+void *
+node_alloc(size_t size)
+{
+	void *p;
+
+	if (kind == NODEALLOC_ARENA)
+		p = arena_alloc(size);
+	else {
+		p = malloc(size);
+		if (p == NULL) {
+			printf("malloc() failed\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	count(0);
+	return p;
+}
+
+void
+node_free(void *p)
+{
+	if (p == NULL)
+		return;
+	count(1);
+	if (kind == NODEALLOC_ARENA)
+		arena_free(p);
+	else
+		free(p);
+}
+
+void
+nodealloc_use(enum nodealloc_kind k)
+{
+	kind = k;
+}
+
+const char *
+nodealloc_name(void)
+{
+	return (kind == NODEALLOC_ARENA) ? "arena" : "malloc";
+}
+
+void
+nodealloc_release(void)
+{
+	struct chunk *c, *next;
+	int i;
+
+	pthread_mutex_lock(&arenalock);
+	for (c = chunks; c != NULL; c = next) {
+		next = c->next;
+		munmap(c, CHUNK_SIZE);
+	}
+	chunks = NULL;
+	for (i = 0; i < NCLASSES; i++)
+		batches[i] = NULL;
+	arenastats.huge = 0;
+	arenastats.transparent = 0;
+	arenastats.small = 0;
+	__atomic_add_fetch(&generation, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&arenalock);
+}
+
+void
+nodealloc_arena_stats(struct arenastats *s)
+{
+	s->huge = __atomic_load_n(&arenastats.huge, __ATOMIC_RELAXED);
+	s->transparent = __atomic_load_n(&arenastats.transparent,
+	    __ATOMIC_RELAXED);
+	s->small = __atomic_load_n(&arenastats.small, __ATOMIC_RELAXED);
+}
+
+int
+numa_nodes(void)
+{
+	static int nnodes = 0;
+	struct dirent *d;
+	DIR *dir;
+	int n;
+
+	if (nnodes > 0)
+		return nnodes;
+	n = 0;
+	dir = opendir("/sys/devices/system/node");
+	if (dir != NULL) {
+		while ((d = readdir(dir)) != NULL)
+			if (strncmp(d->d_name, "node", 4) == 0 &&
+			    d->d_name[4] >= '0' && d->d_name[4] <= '9')
+				n++;
+		closedir(dir);
+	}
+	nnodes = (n > 0) ? n : 1;
+	return nnodes;
+}
+
+int
+cpu_node(int cpu)
+{
+	char path[64];
+	struct dirent *d;
+	DIR *dir;
+	int node;
+
+	/* the node of a CPU is the nodeN entry of its sysfs directory */
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+	dir = opendir(path);
+	if (dir == NULL)
+		return 0;
+	node = 0;
+	while ((d = readdir(dir)) != NULL)
+		if (strncmp(d->d_name, "node", 4) == 0 &&
+		    d->d_name[4] >= '0' && d->d_name[4] <= '9') {
+			node = atoi(d->d_name + 4);
+			break;
+		}
+	closedir(dir);
+	return node;
+}
+
+int
+current_node(void)
+{
+	unsigned int cpu, node;
+
+	if (getcpu(&cpu, &node) != 0)
+		return 0;
+	return (int)node;
+}
+
+int
+address_node(const void *p)
+{
+	void *page;
+	int status;
+
+	/* move_pages() without target nodes reports where pages are */
+	page = (void *)((unsigned long)p & ~(sysconf(_SC_PAGESIZE) - 1));
+	if (syscall(SYS_move_pages, 0, 1UL, &page, NULL, &status, 0) != 0)
+		return -1;
+	return (status >= 0) ? status : -1;
+}
+
+void
+nodealloc_stats(int node, struct nodestats *s)
+{
+	struct threadcounters *c;
+	int i = slot(node);
+
+	pthread_mutex_lock(&counterlock);
+	s->allocs = retired.allocs[i];
+	s->frees = retired.frees[i];
+	for (c = live; c != NULL; c = c->next) {
+		s->allocs += __atomic_load_n(&c->allocs[i], __ATOMIC_RELAXED);
+		s->frees += __atomic_load_n(&c->frees[i], __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&counterlock);
+}
+
+void
+nodealloc_reset(void)
+{
+	struct threadcounters *c;
+	int i;
+
+	pthread_mutex_lock(&counterlock);
+	memset(&retired, 0, sizeof(retired));
+	for (c = live; c != NULL; c = c->next)
+		for (i = 0; i < NODEALLOC_MAXNODES; i++) {
+			__atomic_store_n(&c->allocs[i], 0, __ATOMIC_RELAXED);
+			__atomic_store_n(&c->frees[i], 0, __ATOMIC_RELAXED);
+		}
+	pthread_mutex_unlock(&counterlock);
+}
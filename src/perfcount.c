@@ -0,0 +1,116 @@
+/*
+ * Author: Giannis Giakoumakis
+ * Contact: giannis.m.giakoumakis@gmail.com
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+
+#include "../include/perfcount.h"
+
+const char *perfnames[NPERFEVENTS] = {
+	"cycles", "instructions", "llc_misses", "branch_misses",
+	"context_switches", "dtlb_misses"
+};
+
+static const struct {
+	uint32_t type;
+	uint64_t config;
+} events[NPERFEVENTS] = {
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+	/* loads missing the first level data TLB */
+	{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+	    (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+	    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) }
+};
+
+void
+perf_open(struct perfcounters *pc)
+{
+	struct perf_event_attr attr;
+	int i;
+
+	for (i = 0; i < NPERFEVENTS; i++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = events[i].type;
+		attr.config = events[i].config;
+		/*
+		 * Hardware events in user space only, which
+		 * perf_event_paranoid 2 still allows. Context switches
+		 * happen in the kernel, so excluding it would count
+		 * none.
+		 */
+		attr.exclude_kernel = (events[i].type != PERF_TYPE_SOFTWARE);
+		attr.exclude_hv = 1;
+		/* the PMU may be shared, so scale by the time counted */
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+		    PERF_FORMAT_TOTAL_TIME_RUNNING;
+		pc->fd[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1,
+		    -1, 0);
+	}
+}
+
+void
+perf_read(struct perfcounters *pc, struct perfsample *s)
+{
+	uint64_t buf[3]; /* value, time enabled, time running */
+	int i;
+
+	s->avail = 0;
+	for (i = 0; i < NPERFEVENTS; i++) {
+		s->v[i] = 0;
+		if (pc->fd[i] < 0 ||
+		    read(pc->fd[i], buf, sizeof(buf)) != sizeof(buf))
+			continue;
+		if (buf[2] > 0 && buf[2] < buf[1])
+			buf[0] = (uint64_t)((double)buf[0] * buf[1] / buf[2]);
+		s->v[i] = buf[0];
+		s->avail |= 1U << i;
+	}
+}
+
+void
+perf_close(struct perfcounters *pc)
+{
+	int i;
+
+	for (i = 0; i < NPERFEVENTS; i++) {
+		if (pc->fd[i] >= 0)
+			close(pc->fd[i]);
+		pc->fd[i] = -1;
+	}
+}
+
+void
+perf_diff(struct perfsample *d, struct perfsample *a, struct perfsample *b)
+{
+	int i;
+
+	d->avail = a->avail & b->avail;
+	for (i = 0; i < NPERFEVENTS; i++)
+		d->v[i] = (b->v[i] >= a->v[i]) ? b->v[i] - a->v[i] : 0;
+}
+
+void
+perf_add(struct perfsample *dst, struct perfsample *src)
+{
+	int i;
+
+	dst->avail &= src->avail;
+	for (i = 0; i < NPERFEVENTS; i++)
+		dst->v[i] += src->v[i];
+}
+
+void
+perf_zero(struct perfsample *s)
+{
+	memset(s->v, 0, sizeof(s->v));
+	s->avail = (1U << NPERFEVENTS) - 1;
+}
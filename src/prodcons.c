@@ -3,106 +3,753 @@
  * Contact: giannis.m.giakoumakis@gmail.com
  */
 
+#include <getopt.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "../include/prodcons.h"
 #include "../include/pthread_barrier.h"
 
-int
-main(int argc, char **argv)
+#define NPHASES 3
+
+/* Operations used to measure the dispatch overhead */
+#define DISPATCH_OPS 100000
+
+static const char *phasenames[NPHASES] = {
+	"production", "announcement", "consumption"
+};
+
+const char *mappingnames[] = {
+	"auto", "one-to-one", "fan-in", "fan-out", "any-to-any", NULL
+};
+
+static const char *opnames[NOPS] = {
+	"enqueue", "dequeue", "insert", "delete", "end2end"
+};
+
+/* Set on SIGINT, producers stop and the rest drain the items */
+static volatile sig_atomic_t stopping;
+
+static void
+stop(int sig)
 {
-	pthread_t *producers, *consumers;
-	pthread_barrier_t barrier;
-#if defined _LOCK_FREE_QUEUE
-	struct lfqueue q;
-#else
-	struct queue q;
-#endif
-	struct tree t;
-	struct producerinfo pinfo;
-	struct consumerinfo cinfo;
-	int nthreads;
-	int e, i;
+	stopping = 1;
+}
 
-	/* check args */
-	if (argc != 2)
-		usage(EXIT_FAILURE);
-	nthreads = atoi(argv[1]);
-	if (nthreads <= 0)
-		usage(EXIT_FAILURE);
+/* Rows of a report, the operations each phase is made of */
+static const struct {
+	int phase;
+	enum op op;
+} rows[] = {
+	{ 0, OP_ENQUEUE },
+	{ 1, OP_DEQUEUE },
+	{ 1, OP_INSERT },
+	{ 2, OP_DELETE },
+	{ 2, OP_ENDTOEND }
+};
+
+#define NROWS ((int)(sizeof(rows) / sizeof(rows[0])))
+
+/* Percentiles reported for every operation, besides the maximum */
+#define NPERCENTILES 4
+static const double percentiles[NPERCENTILES] = { 50, 99, 99.9, 99.99 };
+
+/* Results of one phase of a run, merged over its threads */
+struct phaseresult {
+	uint64_t start;
+	uint64_t end;
+	long ops;
+	double seconds;
+	struct perfsample perf;
+};
+
+static void
+merge_phase(struct phaseresult *r, struct phasestats *s, int first)
+{
+	if (first) {
+		r->start = s->start;
+		r->end = s->end;
+		r->ops = 0;
+		perf_zero(&r->perf);
+	}
+	if (s->start < r->start)
+		r->start = s->start;
+	if (s->end > r->end)
+		r->end = s->end;
+	r->ops += s->ops;
+	r->seconds = (r->end - r->start) / 1e9;
+	perf_add(&r->perf, &s->perf);
+}
+
+/*
+ * Print the counters of a phase as CSV fields or JSON members,
+ * leaving unavailable ones empty (null).
+ */
+static void
+print_perf(struct perfsample *p, enum format format)
+{
+	int i;
+
+	for (i = 0; i < NPERFEVENTS; i++) {
+		if (format == FORMAT_JSON)
+			printf(", \"%s\": ", perfnames[i]);
+		else
+			printf(",");
+		if (p->avail & (1U << i))
+			printf("%llu", (unsigned long long)p->v[i]);
+		else if (format == FORMAT_JSON)
+			printf("null");
+	}
+}
+
+/* Print the counters of every phase as a table */
+static void
+print_perf_table(struct phaseresult *r)
+{
+	struct perfsample *p;
+	unsigned int avail;
+	int i, j;
+
+	avail = 0;
+	for (i = 0; i < NPHASES; i++)
+		avail |= r[i].perf.avail;
+	if (avail == 0) {
+		printf("  performance counters unavailable\n");
+		return;
+	}
+	printf("  %-13s", "phase");
+	for (j = 0; j < NPERFEVENTS; j++)
+		printf(" %16s", perfnames[j]);
+	printf(" %6s\n", "ipc");
+	for (i = 0; i < NPHASES; i++) {
+		p = &r[i].perf;
+		printf("  %-13s", phasenames[i]);
+		for (j = 0; j < NPERFEVENTS; j++)
+			if (p->avail & (1U << j))
+				printf(" %16llu", (unsigned long long)p->v[j]);
+			else
+				printf(" %16s", "-");
+		if ((p->avail & (1U << PERF_CYCLES)) &&
+		    (p->avail & (1U << PERF_INSTRUCTIONS)) &&
+		    p->v[PERF_CYCLES] > 0)
+			printf(" %6.2f\n", (double)p->v[PERF_INSTRUCTIONS] /
+			    p->v[PERF_CYCLES]);
+		else
+			printf(" %6s\n", "-");
+	}
+}
+
+/* Add the latencies of a thread to the ones of the run */
+static void
+merge_latency(struct latency *dst, struct latency *src)
+{
+	int i;
+
+	for (i = 0; i < NOPS; i++) {
+		latency_merge(&dst[i], &src[i]);
+		latency_free(&src[i]);
+	}
+}
+
+static const char *
+modename(struct config *cfg)
+{
+	return cfg->stream ? "stream" : "phased";
+}
+
+/*
+ * lat holds the latencies of every operation, merged over the
+ * threads. qnode and tnode are the NUMA nodes holding the queue
+ * and the tree (their head, tail and root pointers and locks).
+ */
+static void
+report(struct config *cfg, int run, struct phaseresult *r,
+    struct latency *lat, int qnode, int tnode)
+{
+	static int records = 0;
+	struct nodestats ns;
+	struct arenastats as;
+	struct phaseresult *ph;
+	struct latency *l;
+	uint64_t pct[NPERCENTILES];
+	double opsps;
+	int i, j;
+
+	if (cfg->format == FORMAT_HUMAN)
+		printf("run %d: queue=%s tree=%s producers=%d consumers=%d"
+		    " mapping=%s mode=%s lock=%s alloc=%s"
+		    " dispatch=%.1f/%.1f ns/op affinity=%s\n"
+		    "  %-13s %-8s %9s %9s %12s %10s %10s %10s %10s %10s\n", run,
+		    cfg->qops->name, cfg->mops->name, cfg->nproducers,
+		    cfg->nconsumers, mappingnames[cfg->mapping],
+		    modename(cfg), LOCK_NAME, nodealloc_name(), cfg->qdispatch,
+		    cfg->mdispatch,
+		    cfg->affinity.name, "phase", "op", "items", "seconds",
+		    "ops/sec", "p50(ns)", "p99(ns)", "p99.9(ns)",
+		    "p99.99(ns)", "max(ns)");
+	else if (cfg->format == FORMAT_CSV && records == 0)
+		printf("run,queue,tree,phase,op,producers,consumers,mapping,"
+		    "mode,announcers,inflight,items,"
+		    "seconds,ops_per_sec,p50_ns,p99_ns,p999_ns,p9999_ns,"
+		    "max_ns,queue_dispatch_ns,tree_dispatch_ns,affinity,"
+		    "queue_numa_node,tree_numa_node,cycles,instructions,"
+		    "llc_misses,branch_misses,context_switches,dtlb_misses\n");
+
+	for (i = 0; i < NROWS; i++) {
+		if (rows[i].op == OP_ENDTOEND && !cfg->stream)
+			continue;
+		ph = &r[rows[i].phase];
+		l = &lat[rows[i].op];
+		opsps = (ph->seconds > 0) ? ph->ops / ph->seconds : 0;
+		for (j = 0; j < NPERCENTILES; j++)
+			pct[j] = latency_percentile(l, percentiles[j]);
+		switch (cfg->format) {
+		case FORMAT_HUMAN:
+			/* phase figures only on the first row of a phase */
+			if (i == 0 || rows[i - 1].phase != rows[i].phase)
+				printf("  %-13s %-8s %9ld %9.4f %12.0f",
+				    phasenames[rows[i].phase],
+				    opnames[rows[i].op], ph->ops, ph->seconds,
+				    opsps);
+			else
+				printf("  %-13s %-8s %9s %9s %12s", "",
+				    opnames[rows[i].op], "", "", "");
+			printf(" %10llu %10llu %10llu %10llu %10llu\n",
+			    (unsigned long long)pct[0],
+			    (unsigned long long)pct[1],
+			    (unsigned long long)pct[2],
+			    (unsigned long long)pct[3],
+			    (unsigned long long)l->max);
+			break;
+		case FORMAT_CSV:
+			printf("%d,%s,%s,%s,%s,%d,%d,%s,%s,%d,%d,%ld,%.6f,%.0f,%llu,%llu,"
+			    "%llu,%llu,%llu,%.1f,%.1f,\"%s\",%d,%d", run,
+			    cfg->qops->name, cfg->mops->name,
+			    phasenames[rows[i].phase], opnames[rows[i].op],
+			    cfg->nproducers, cfg->nconsumers,
+			    mappingnames[cfg->mapping], modename(cfg),
+			    cfg->nannouncers, cfg->stream ? cfg->inflight : 0,
+			    ph->ops, ph->seconds, opsps, (unsigned long long)pct[0],
+			    (unsigned long long)pct[1],
+			    (unsigned long long)pct[2],
+			    (unsigned long long)pct[3],
+			    (unsigned long long)l->max, cfg->qdispatch,
+			    cfg->mdispatch, cfg->affinity.name, qnode, tnode);
+			print_perf(&ph->perf, FORMAT_CSV);
+			printf("\n");
+			break;
+		case FORMAT_JSON:
+			printf("%s\n  {\"run\": %d, \"queue\": \"%s\", "
+			    "\"tree\": \"%s\", \"phase\": \"%s\", "
+			    "\"op\": \"%s\", \"producers\": %d, "
+			    "\"consumers\": %d, \"mapping\": \"%s\", "
+			    "\"mode\": \"%s\", \"announcers\": %d, "
+			    "\"inflight\": %d, \"items\": %ld, "
+			    "\"seconds\": %.6f, \"ops_per_sec\": %.0f, "
+			    "\"p50_ns\": %llu, \"p99_ns\": %llu, "
+			    "\"p999_ns\": %llu, \"p9999_ns\": %llu, "
+			    "\"max_ns\": %llu, "
+			    "\"queue_dispatch_ns\": %.1f, "
+			    "\"tree_dispatch_ns\": %.1f, \"affinity\": \"%s\", "
+			    "\"queue_numa_node\": %d, \"tree_numa_node\": %d",
+			    (records == 0) ? "[" : ",", run, cfg->qops->name,
+			    cfg->mops->name, phasenames[rows[i].phase],
+			    opnames[rows[i].op], cfg->nproducers,
+			    cfg->nconsumers, mappingnames[cfg->mapping],
+			    modename(cfg), cfg->nannouncers,
+			    cfg->stream ? cfg->inflight : 0, ph->ops,
+			    ph->seconds, opsps,
+			    (unsigned long long)pct[0],
+			    (unsigned long long)pct[1],
+			    (unsigned long long)pct[2],
+			    (unsigned long long)pct[3],
+			    (unsigned long long)l->max, cfg->qdispatch,
+			    cfg->mdispatch, cfg->affinity.name, qnode, tnode);
+			print_perf(&ph->perf, FORMAT_JSON);
+			printf("}");
+			break;
+		}
+		records++;
+	}
+
+	/* Where nodes were allocated and freed, by NUMA node */
+	if (cfg->format == FORMAT_HUMAN) {
+		print_perf_table(r);
+		printf("  queue on numa node %d, tree on numa node %d\n",
+		    qnode, tnode);
+		for (i = 0; i < numa_nodes() && i < NODEALLOC_MAXNODES; i++) {
+			nodealloc_stats(i, &ns);
+			printf("  numa node %d: %ld nodes allocated, %ld"
+			    " freed\n", i, ns.allocs, ns.frees);
+		}
+		nodealloc_arena_stats(&as);
+		if (as.huge + as.transparent + as.small > 0)
+			printf("  arena: %ld chunks of huge pages, %ld of"
+			    " transparent ones, %ld of normal ones\n",
+			    as.huge, as.transparent, as.small);
+	}
+}
+
+/*
+ * Run the three phases once with fresh data structures.
+ * Results are reported only if run > 0.
+ */
+static void
+runonce(struct config *cfg, int run)
+{
+	pthread_t *producers, *consumers, *announcers;
+	struct runinfo rinfo;
+	struct producerinfo *pinfo, *ainfo;
+	struct consumerinfo *cinfo;
+	struct phaseresult result[NPHASES];
+	struct latency lat[NOPS];
+	pthread_attr_t attr;
+	int nthreads, nstream, qnode, tnode;
+	long left;
+	int e, i;
 
 	/*
 	 * Allocate memory, initialize data structures, common
-	 * barrier and initialize producer/consumer structs.
+	 * barriers and initialize producer/consumer structs.
 	 */
-	producers = malloc(nthreads * sizeof(pthread_t));
-	if (producers == NULL) {
+	nstream = cfg->stream ? cfg->nannouncers : 0;
+	nthreads = cfg->nproducers + cfg->nconsumers + nstream;
+	producers = malloc(cfg->nproducers * sizeof(pthread_t));
+	consumers = malloc(cfg->nconsumers * sizeof(pthread_t));
+	announcers = malloc((nstream + 1) * sizeof(pthread_t));
+	pinfo = calloc(cfg->nproducers, sizeof(struct producerinfo));
+	cinfo = calloc(cfg->nconsumers, sizeof(struct consumerinfo));
+	ainfo = calloc(nstream + 1, sizeof(struct producerinfo));
+	rinfo.assigned = calloc(cfg->nconsumers, sizeof(int));
+	if (producers == NULL || consumers == NULL || announcers == NULL ||
+	    pinfo == NULL || cinfo == NULL || ainfo == NULL ||
+	    rinfo.assigned == NULL) {
 		printf("malloc() failed\n");
 		exit(EXIT_FAILURE);
 	}
-	consumers = malloc(nthreads * sizeof(pthread_t));
-	if (consumers == NULL) {
-		printf("malloc() failed\n");
+	/*
+	 * A ring of enqueue times per owner of a timestamp sequence
+	 * (see bornslot()), with room for twice as many timestamps
+	 * as can be in flight, so producers seldom wait for a slot.
+	 */
+	rinfo.born = NULL;
+	rinfo.bornmask = 0;
+	if (cfg->stream) {
+		for (i = 1; i < 2 * cfg->inflight; i *= 2)
+			;
+		e = (cfg->mapping == MAPPING_ANY) ? cfg->nproducers :
+		    cfg->nconsumers;
+		rinfo.born = calloc((size_t)i * e, sizeof(uint64_t));
+		if (rinfo.born == NULL) {
+			printf("malloc() failed\n");
+			exit(EXIT_FAILURE);
+		}
+		rinfo.bornmask = i - 1;
+	}
+	e = pthread_barrier_init(&rinfo.start, NULL, nthreads);
+	if (e != 0) {
+		printf("pthread_barrier_init() failed\n");
 		exit(EXIT_FAILURE);
 	}
-	e = pthread_barrier_init(&barrier, NULL, nthreads * 2);
+	e = pthread_barrier_init(&rinfo.barrier, NULL, nthreads);
 	if (e != 0) {
 		printf("pthread_barrier_init() failed\n");
 		exit(EXIT_FAILURE);
 	}
-#if defined _LOCK_FREE_QUEUE
-	initlfqueue(&q);
-#else
-	initqueue(&q);
-#endif
-	inittree(&t);
 
-	pinfo.tid = producers;
-	pinfo.nthreads = nthreads;
-	pinfo.barrier = &barrier;
-	pinfo.queue = &q;
-	pinfo.tree = &t;
-
-	cinfo.tid = consumers;
-	cinfo.nthreads = nthreads;
-	cinfo.barrier = &barrier;
-	cinfo.tree = &t;
+	rinfo.cfg = cfg;
+	rinfo.produced = 0;
+	rinfo.done = 0;
+	rinfo.inflight = 0;
+	nodealloc_reset();
+	rinfo.queue = cfg->qops->create();
+	if (cfg->capacity > 0)
+		cfg->qops->bound(rinfo.queue, cfg->capacity);
+	rinfo.tree = cfg->mops->create();
+	rinfo.transplant = cfg->qops->enqueue_node != NULL &&
+	    cfg->mops->insert_node != NULL;
+	rinfo.trace = NULL;
+	if (cfg->tracefile != NULL && run == 1) {
+		rinfo.trace = malloc(nthreads * sizeof(struct tracebuf));
+		if (rinfo.trace == NULL) {
+			printf("malloc() failed\n");
+			exit(EXIT_FAILURE);
+		}
+		for (i = 0; i < nthreads; i++)
+			inittracebuf(&rinfo.trace[i]);
+	}
 
 	/* Spawn producers */
-	for (i = 0; i < nthreads; i++) {
-		e = pthread_create(&producers[i], NULL, produce,
-		    (void *)&pinfo);
+	for (i = 0; i < cfg->nproducers; i++) {
+		pinfo[i].id = i;
+		pinfo[i].run = &rinfo;
+		affinity_attr(&cfg->affinity, i, &attr);
+		e = pthread_create(&producers[i], &attr, produce,
+		    (void *)&pinfo[i]);
 		if (e != 0) {
 			printf("pthread_create() failed\n");
 			exit(EXIT_FAILURE);
 		}
+		pthread_attr_destroy(&attr);
 	}
 	/* Spawn consumers */
-	for (i = 0; i < nthreads; i++) {
-		e = pthread_create(&consumers[i], NULL, consume,
-		    (void *)&cinfo);
+	for (i = 0; i < cfg->nconsumers; i++) {
+		cinfo[i].id = i;
+		cinfo[i].run = &rinfo;
+		affinity_attr(&cfg->affinity, cfg->nproducers + i, &attr);
+		e = pthread_create(&consumers[i], &attr, consume,
+		    (void *)&cinfo[i]);
+		if (e != 0) {
+			printf("pthread_create() failed\n");
+			exit(EXIT_FAILURE);
+		}
+		pthread_attr_destroy(&attr);
+	}
+	/* Spawn the announcers of a streaming run */
+	for (i = 0; i < nstream; i++) {
+		ainfo[i].id = i;
+		ainfo[i].run = &rinfo;
+		affinity_attr(&cfg->affinity,
+		    cfg->nproducers + cfg->nconsumers + i, &attr);
+		e = pthread_create(&announcers[i], &attr, announce,
+		    (void *)&ainfo[i]);
 		if (e != 0) {
 			printf("pthread_create() failed\n");
 			exit(EXIT_FAILURE);
 		}
+		pthread_attr_destroy(&attr);
 	}
 	/*
-	 * Join every spawned thread, both the consumers and
-	 * the producers
+	 * Join every spawned thread, the consumers, the
+	 * producers and the announcers
 	 */
-	for (i = 0; i < nthreads; i++) {
+	for (i = 0; i < cfg->nproducers; i++) {
 		e = pthread_join(producers[i], NULL);
 		if (e != 0) {
 			printf("pthread_join() failed\n");
 			exit(EXIT_FAILURE);
 		}
+	}
+	for (i = 0; i < cfg->nconsumers; i++) {
 		e = pthread_join(consumers[i], NULL);
 		if (e != 0) {
 			printf("pthread_join() failed\n");
 			exit(EXIT_FAILURE);
 		}
 	}
+	for (i = 0; i < nstream; i++) {
+		e = pthread_join(announcers[i], NULL);
+		if (e != 0) {
+			printf("pthread_join() failed\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	/* A phase lasts from its first start to its last end */
+	for (i = 0; i < NOPS; i++)
+		initlatency(&lat[i]);
+	for (i = 0; i < cfg->nproducers; i++) {
+		merge_phase(&result[0], &pinfo[i].production, i == 0);
+		if (!cfg->stream)
+			merge_phase(&result[1], &pinfo[i].announcement,
+			    i == 0);
+		merge_latency(lat, pinfo[i].lat);
+	}
+	for (i = 0; i < nstream; i++) {
+		merge_phase(&result[1], &ainfo[i].announcement, i == 0);
+		merge_latency(lat, ainfo[i].lat);
+	}
+	for (i = 0; i < cfg->nconsumers; i++) {
+		merge_phase(&result[2], &cinfo[i].consumption, i == 0);
+		merge_latency(lat, cinfo[i].lat);
+	}
+	qnode = address_node(rinfo.queue);
+	tnode = address_node(rinfo.tree);
+	if (run > 0)
+		report(cfg, run, result, lat, qnode, tnode);
+	/* every item should have been consumed, say so if not */
+	left = 0;
+	if (cfg->qops->size != NULL)
+		left += cfg->qops->size(rinfo.queue, 1);
+	if (cfg->mops->size != NULL)
+		left += cfg->mops->size(rinfo.tree, 1);
+	if (left > 0)
+		fprintf(stderr, "run %d: %ld items left unconsumed\n", run,
+		    left);
+	for (i = 0; i < NOPS; i++)
+		latency_free(&lat[i]);
+
+	if (rinfo.trace != NULL) {
+		if (trace_write(cfg->tracefile, rinfo.trace, nthreads) != 0) {
+			perror(cfg->tracefile);
+			exit(EXIT_FAILURE);
+		}
+		for (i = 0; i < nthreads; i++)
+			tracebuf_free(&rinfo.trace[i]);
+		free(rinfo.trace);
+	}
+
+	cfg->qops->destroy(rinfo.queue);
+	cfg->mops->destroy(rinfo.tree);
+	/* no node is left, hand the arena back in one go */
+	nodealloc_release();
+	pthread_barrier_destroy(&rinfo.start);
+	pthread_barrier_destroy(&rinfo.barrier);
+	free(producers);
+	free(consumers);
+	free(announcers);
+	free(pinfo);
+	free(cinfo);
+	free(ainfo);
+	free(rinfo.assigned);
+	free(rinfo.born);
+}
+
+/*
+ * Resolve MAPPING_AUTO and check that the mapping fits the
+ * thread counts. Return 0 on success, -1 otherwise.
+ */
+static int
+check_mapping(struct config *cfg)
+{
+	int p = cfg->nproducers, c = cfg->nconsumers;
+
+	switch (cfg->mapping) {
+	case MAPPING_AUTO:
+		if (p == c)
+			cfg->mapping = MAPPING_ONE_TO_ONE;
+		else
+			cfg->mapping = (p > c) ? MAPPING_FAN_IN :
+			    MAPPING_FAN_OUT;
+		return 0;
+	case MAPPING_ONE_TO_ONE:
+		return (p == c) ? 0 : -1;
+	case MAPPING_FAN_IN:
+		return (p >= c) ? 0 : -1;
+	case MAPPING_FAN_OUT:
+		return (p <= c) ? 0 : -1;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Consumer of the i-th item of producer pid. Under fan-out,
+ * producer pid owns consumers pid, pid + P, pid + 2P, ...
+ * and deals its items to them in turn.
+ */
+static int
+route(struct config *cfg, int pid, int i)
+{
+	int p = cfg->nproducers, c = cfg->nconsumers, k;
+
+	switch (cfg->mapping) {
+	case MAPPING_FAN_IN:
+		return pid % c;
+	case MAPPING_FAN_OUT:
+		k = (c - pid + p - 1) / p;
+		return pid + (i % k) * p;
+	default:
+		return pid;
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	static struct option longopts[] = {
+		{ "producers",	 required_argument, NULL, 'p' },
+		{ "consumers",	 required_argument, NULL, 'c' },
+		{ "items",	 required_argument, NULL, 'n' },
+		{ "duration",	 required_argument, NULL, 'd' },
+		{ "warmup",	 required_argument, NULL, 'w' },
+		{ "repetitions", required_argument, NULL, 'r' },
+		{ "format",	 required_argument, NULL, 'f' },
+		{ "mapping",	 required_argument, NULL, 'm' },
+		{ "stream",	 no_argument,	    NULL, 's' },
+		{ "announcers",	 required_argument, NULL, 'A' },
+		{ "inflight",	 required_argument, NULL, 'b' },
+		{ "capacity",	 required_argument, NULL, 'Q' },
+		{ "queue",	 required_argument, NULL, 'q' },
+		{ "tree",	 required_argument, NULL, 't' },
+		{ "affinity",	 required_argument, NULL, 'a' },
+		{ "record",	 required_argument, NULL, 'R' },
+		{ "alloc",	 required_argument, NULL, 'M' },
+		{ "help",	 no_argument,	    NULL, 'h' },
+		{ NULL,		 0,		    NULL, 0 }
+	};
+	struct config cfg;
+	struct sigaction sa;
+	int opt, i;
+
+	cfg.nproducers = 0;
+	cfg.nconsumers = 0;
+	cfg.nitems = 0;
+	cfg.duration = 0;
+	cfg.warmup = 0;
+	cfg.repetitions = 1;
+	cfg.format = FORMAT_HUMAN;
+	cfg.mapping = MAPPING_AUTO;
+	cfg.stream = 0;
+	cfg.nannouncers = 0;
+	cfg.inflight = 4096;
+	cfg.capacity = 0;
+	cfg.qops = queue_backends[0];
+	cfg.mops = map_backends[0];
+	parse_affinity(&cfg.affinity, "none");
+	cfg.tracefile = NULL;
+
+	/* check args */
+	while ((opt = getopt_long(argc, argv, "p:c:n:d:w:r:f:m:sA:b:Q:q:t:a:R:M:h",
+	    longopts, NULL)) != -1) {
+		switch (opt) {
+		case 'p':
+			cfg.nproducers = atoi(optarg);
+			break;
+		case 'c':
+			cfg.nconsumers = atoi(optarg);
+			break;
+		case 'n':
+			cfg.nitems = atoi(optarg);
+			break;
+		case 'd':
+			cfg.duration = atof(optarg);
+			break;
+		case 'w':
+			cfg.warmup = atoi(optarg);
+			break;
+		case 'r':
+			cfg.repetitions = atoi(optarg);
+			break;
+		case 'f':
+			if (strcmp(optarg, "human") == 0)
+				cfg.format = FORMAT_HUMAN;
+			else if (strcmp(optarg, "csv") == 0)
+				cfg.format = FORMAT_CSV;
+			else if (strcmp(optarg, "json") == 0)
+				cfg.format = FORMAT_JSON;
+			else
+				usage(EXIT_FAILURE);
+			break;
+		case 'm':
+			for (i = 0; mappingnames[i] != NULL; i++)
+				if (strcmp(optarg, mappingnames[i]) == 0)
+					break;
+			if (mappingnames[i] == NULL)
+				usage(EXIT_FAILURE);
+			cfg.mapping = (enum mapping)i;
+			break;
+		case 's':
+			cfg.stream = 1;
+			break;
+		case 'A':
+			cfg.nannouncers = atoi(optarg);
+			break;
+		case 'b':
+			cfg.inflight = atoi(optarg);
+			break;
+		case 'Q':
+			cfg.capacity = atoi(optarg);
+			break;
+		case 'q':
+			cfg.qops = find_queue_ops(optarg);
+			if (cfg.qops == NULL)
+				usage(EXIT_FAILURE);
+			break;
+		case 't':
+			cfg.mops = find_map_ops(optarg);
+			if (cfg.mops == NULL)
+				usage(EXIT_FAILURE);
+			break;
+		case 'a':
+			free_affinity(&cfg.affinity);
+			if (parse_affinity(&cfg.affinity, optarg) != 0)
+				usage(EXIT_FAILURE);
+			break;
+		case 'R':
+			cfg.tracefile = optarg;
+			break;
+		case 'M':
+			if (strcmp(optarg, "malloc") == 0)
+				nodealloc_use(NODEALLOC_MALLOC);
+			else if (strcmp(optarg, "arena") == 0)
+				nodealloc_use(NODEALLOC_ARENA);
+			else
+				usage(EXIT_FAILURE);
+			break;
+		case 'h':
+			usage(EXIT_SUCCESS);
+		default:
+			usage(EXIT_FAILURE);
+		}
+	}
+
+	/*
+	 * The old form "prodcons N" stands for N producers, N
+	 * consumers and N items per producer.
+	 */
+	if (optind == argc - 1) {
+		i = atoi(argv[optind]);
+		if (i <= 0)
+			usage(EXIT_FAILURE);
+		if (cfg.nproducers == 0)
+			cfg.nproducers = i;
+		if (cfg.nconsumers == 0)
+			cfg.nconsumers = i;
+		if (cfg.nitems == 0 && cfg.duration == 0)
+			cfg.nitems = i;
+	} else if (optind != argc)
+		usage(EXIT_FAILURE);
+	if (cfg.nproducers <= 0 || cfg.nconsumers <= 0 ||
+	    (cfg.nitems <= 0 && cfg.duration <= 0) || cfg.warmup < 0 ||
+	    cfg.repetitions <= 0 || cfg.nannouncers < 0 || cfg.inflight <= 0)
+		usage(EXIT_FAILURE);
+	if (!cfg.stream || cfg.nannouncers == 0)
+		cfg.nannouncers = cfg.nproducers;
+	/* a phased run would wait for space forever */
+	if (cfg.capacity < 0 || (cfg.capacity > 0 && (!cfg.stream ||
+	    cfg.qops->bound == NULL))) {
+		printf("a queue capacity needs a streaming run and a"
+		    " queue that can be bounded\n");
+		exit(EXIT_FAILURE);
+	}
+	if (check_mapping(&cfg) != 0) {
+		printf("mapping %s does not fit %d producers and"
+		    " %d consumers\n", mappingnames[cfg.mapping],
+		    cfg.nproducers, cfg.nconsumers);
+		exit(EXIT_FAILURE);
+	}
+
+	/*
+	 * The main thread creates the queue and the tree, so it
+	 * runs where the first producer will, and so does the
+	 * memory holding their heads and locks.
+	 */
+	affinity_apply(&cfg.affinity, 0);
+
+	cfg.qdispatch = queue_dispatch_ns(cfg.qops, DISPATCH_OPS);
+	cfg.mdispatch = map_dispatch_ns(cfg.mops, DISPATCH_OPS);
+
+	/* on SIGINT, end the run in progress cleanly */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = stop;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+
+	for (i = 0; i < cfg.warmup && !stopping; i++)
+		runonce(&cfg, 0);
+	/* count the reported runs only */
+	stats_reset();
+	for (i = 1; i <= cfg.repetitions && !stopping; i++)
+		runonce(&cfg, i);
+	if (cfg.format == FORMAT_JSON)
+		printf("\n]\n");
+	/* keep machine readable output parseable */
+	stats_dump((cfg.format == FORMAT_HUMAN) ? stdout : stderr);
+	free_affinity(&cfg.affinity);
 
 	return 0;
 }
@@ -110,41 +757,252 @@ main(int argc, char **argv)
 void
 usage(int exit_code)
 {
-	printf("usage: ./prodcons.x N\n"
-	    "\tN: number of producers/consumers\n");
+	int i;
+
+	printf("usage: ./prodcons [options] [N]\n"
+	    "\tN: shorthand for -p N -c N -n N\n"
+	    "\t-p, --producers=P    number of producers\n"
+	    "\t-c, --consumers=C    number of consumers\n"
+	    "\t-n, --items=I        items made by each producer\n"
+	    "\t-d, --duration=S     produce for S seconds instead of"
+	    " a fixed number of items,\n"
+	    "\t                     the other phases drain everything\n"
+	    "\t-w, --warmup=W       unreported runs before measuring"
+	    " (default 0)\n"
+	    "\t-r, --repetitions=R  reported runs (default 1)\n"
+	    "\t-f, --format=F       human, csv or json"
+	    " (default human)\n"
+	    "\t-m, --mapping=M      consumers of the items of each"
+	    " producer: one-to-one\n"
+	    "\t                     (P = C), fan-in (P >= C), fan-out"
+	    " (P <= C), any-to-any\n"
+	    "\t                     or auto, which picks one of the"
+	    " first three (default auto)\n"
+	    "\t-s, --stream         produce, announce and consume all"
+	    " at once, reporting the\n"
+	    "\t                     end to end latency of the items\n"
+	    "\t-A, --announcers=A   announcer threads of a streaming"
+	    " run (default P)\n"
+	    "\t-b, --inflight=B     items made but not consumed yet"
+	    " in a streaming run,\n"
+	    "\t                     producers wait beyond that"
+	    " (default 4096)\n"
+	    "\t-Q, --capacity=N     bound the queue of a streaming"
+	    " run to N items, producers\n"
+	    "\t                     park while it is full (lock and"
+	    " lockfree queues)\n"
+	    "\t-q, --queue=Q        queue implementation:");
+	for (i = 0; queue_backends[i] != NULL; i++)
+		printf(" %s", queue_backends[i]->name);
+	printf(" (default %s)\n"
+	    "\t-t, --tree=T         tree implementation:",
+	    queue_backends[0]->name);
+	for (i = 0; map_backends[i] != NULL; i++)
+		printf(" %s", map_backends[i]->name);
+	printf(" (default %s)\n"
+	    "\t-a, --affinity=A     thread placement: none, compact"
+	    " (fill a NUMA node first),\n"
+	    "\t                     scatter (round robin over NUMA"
+	    " nodes) or a CPU list\n"
+	    "\t                     like 0,2,8-11; producers come"
+	    " first (default none)\n"
+	    "\t-R, --record=FILE    record the operations of the first"
+	    " reported run to FILE,\n"
+	    "\t                     for bin/replay\n"
+	    "\t-M, --alloc=A        node allocator: malloc, or arena"
+	    " for huge page backed\n"
+	    "\t                     chunks released after every run"
+	    " (default malloc)\n",
+	    map_backends[0]->name);
 	exit(exit_code);
 }
 
+/*
+ * Move one item from the queue to the tree, timing both
+ * operations from *t0 on. Return 0 if the queue was empty.
+ */
+static int
+announce_one(struct producerinfo *pinfo, struct tracebuf *tb, int tid,
+    uint64_t *t0)
+{
+	struct runinfo *run = pinfo->run;
+	const struct queue_ops *qops = run->cfg->qops;
+	const struct map_ops *mops = run->cfg->mops;
+	struct tree_node *node;
+	struct info inf;
+	uint64_t tm, t1;
+	int timestamp;
+
+	if (run->transplant) {
+		node = queue_dequeue_node(qops, run->queue);
+		if (node == NULL)
+			return 0;
+		tm = now_ns();
+		timestamp = node->inf.timestamp;
+		if (!map_insert_node(mops, run->tree, node)) {
+			destroylock(&node->lock);
+			node_free(node);
+		}
+	} else {
+		if (!qops->dequeue(run->queue, &inf))
+			return 0;
+		tm = now_ns();
+		timestamp = inf.timestamp;
+		mops->insert(run->tree, inf.producerID, inf.timestamp);
+	}
+	t1 = now_ns();
+	latency_add(&pinfo->lat[OP_DEQUEUE], tm - *t0);
+	latency_add(&pinfo->lat[OP_INSERT], t1 - tm);
+	if (tb != NULL) {
+		trace_add(tb, tid, TRACE_DEQUEUE, timestamp);
+		trace_add(tb, tid, TRACE_INSERT, timestamp);
+	}
+	pinfo->announcement.ops++;
+	*t0 = t1;
+	return 1;
+}
+
+/*
+ * Slot of the enqueue time of a timestamp. Timestamps come in
+ * one sequence per consumer with a mapping, per producer
+ * otherwise (see produce()), and each sequence has a ring of
+ * its own, indexed by the position in the sequence.
+ */
+static uint64_t *
+bornslot(struct runinfo *run, int timestamp)
+{
+	int n, owner, seq;
+
+	n = (run->cfg->mapping == MAPPING_ANY) ? run->cfg->nproducers :
+	    run->cfg->nconsumers;
+	owner = timestamp % n;
+	seq = timestamp / n;
+	return &run->born[(size_t)owner * (run->bornmask + 1) +
+	    (seq & run->bornmask)];
+}
+
+/*
+ * Wait for room for one more item in a streaming run, then
+ * for the slot of its enqueue time to be free. A slot is
+ * taken by an older item only until that item is consumed.
+ */
+static void
+admit(struct runinfo *run)
+{
+	while (__atomic_fetch_add(&run->inflight, 1, __ATOMIC_ACQUIRE) >=
+	    run->cfg->inflight) {
+		__atomic_fetch_sub(&run->inflight, 1, __ATOMIC_RELAXED);
+		sched_yield();
+	}
+}
+
+static void
+stamp(struct runinfo *run, int timestamp, uint64_t t)
+{
+	uint64_t *slot;
+
+	slot = bornslot(run, timestamp);
+	/*
+	 * A consumer of a mapping takes its sequence in order, so
+	 * at most inflight of its timestamps are pending and they
+	 * fit its ring. Waiting there could deadlock a bounded
+	 * queue, so a busy slot is a bug. Without a mapping any
+	 * consumer takes the older item sooner or later.
+	 */
+	if (run->cfg->mapping != MAPPING_ANY &&
+	    __atomic_load_n(slot, __ATOMIC_ACQUIRE) != 0) {
+		printf("stamp(): slot of timestamp %d is in use\n",
+		    timestamp);
+		exit(EXIT_FAILURE);
+	}
+	while (__atomic_load_n(slot, __ATOMIC_ACQUIRE) != 0)
+		sched_yield();
+	*slot = t;
+}
+
 void *
 produce(void *arg)
 {
 	struct producerinfo *pinfo;
-	pthread_t tid; /* threadID */
+	struct runinfo *run;
+	struct config *cfg;
 	int pid; /* producerID */
-	struct info *result;
-	int i, timestamp;
+	const struct queue_ops *qops;
+	struct perfcounters pc;
+	struct perfsample s0, s1;
+	struct tracebuf *tb;
+	uint64_t t0, t1, deadline;
+	int i, c, timestamp;
 
 	pinfo = (struct producerinfo *)arg;
+	run = pinfo->run;
+	cfg = run->cfg;
+	pid = pinfo->id;
+	qops = cfg->qops;
+	for (i = 0; i < NOPS; i++)
+		initlatency(&pinfo->lat[i]);
+	perf_open(&pc);
+	tb = (run->trace != NULL) ? &run->trace[pid] : NULL;
+
+	pthread_barrier_wait(&run->start);
+	if (tb != NULL)
+		trace_add(tb, pid, TRACE_BARRIER, 0);
 
-	/* Map pthread_t to int to be more readable */
-	tid = pthread_self();
-	for (i = 0; i < pinfo->nthreads; i++) {
-		if (tid == pinfo->tid[i]) {
-			pid = i;
+	/*
+	 * Data production phase using a shared queue.
+	 * Timestamps are unique across producers. With a mapping,
+	 * the item gets the next timestamp of the consumer it is
+	 * routed to, otherwise the i-th item of producer pid gets
+	 * (i * nproducers) + pid.
+	 */
+#ifdef _VERBOSE
+	printf("producer%d just start inserting into the"
+	    " shared queue\n", pid);
+#endif /* _VERBOSE */
+	perf_read(&pc, &s0);
+	pinfo->production.start = t0 = now_ns();
+	deadline = t0 + (uint64_t)(cfg->duration * 1e9);
+	for (i = 0; !stopping; i++) {
+		if (cfg->duration > 0) {
+			if (t0 >= deadline)
+				break;
+		} else if (i == cfg->nitems)
 			break;
+		if (cfg->stream) {
+			/* waiting for room is not part of the enqueue */
+			admit(run);
+			t0 = now_ns();
+		}
+		if (cfg->mapping == MAPPING_ANY)
+			timestamp = (i * cfg->nproducers) + pid;
+		else {
+			c = route(cfg, pid, i);
+			timestamp = __atomic_fetch_add(&run->assigned[c], 1,
+			    __ATOMIC_RELAXED) * cfg->nconsumers + c;
 		}
+		if (cfg->stream)
+			stamp(run, timestamp, t0);
+		if (run->transplant)
+			queue_enqueue_node(qops, run->queue,
+			    alloctreenode(pid, timestamp));
+		else
+			queue_enqueue(qops, run->queue, pid, timestamp);
+		t1 = now_ns();
+		latency_add(&pinfo->lat[OP_ENQUEUE], t1 - t0);
+		if (tb != NULL)
+			trace_add(tb, pid, TRACE_ENQUEUE, timestamp);
+		t0 = t1;
 	}
+	pinfo->production.end = t0;
+	perf_read(&pc, &s1);
+	perf_diff(&pinfo->production.perf, &s0, &s1);
+	pinfo->production.ops = i;
+	__atomic_add_fetch(&run->produced, 1, __ATOMIC_RELEASE);
 
-	/* Data production phase using a shared queue */
-	printf("producer%d just start inserting into the"
-	    " shared queue\n", pid);
-	for (i = 0; i < pinfo->nthreads; i++) {
-		timestamp = (i * pinfo->nthreads) + pid;
-#if defined _LOCK_FREE_QUEUE
-		lfenqueue(pinfo->queue, pid, timestamp);
-#else
-		enqueue(pinfo->queue, pid, timestamp);
-#endif
+	/* Streaming runs have announcers of their own */
+	if (cfg->stream) {
+		perf_close(&pc);
+		return NULL;
 	}
 
 	/*
@@ -152,54 +1010,157 @@ produce(void *arg)
 	 * data into the shared queue before the announcement
 	 * of the data to the consumers take place.
 	 */
-	pthread_barrier_wait(pinfo->barrier);
+	pthread_barrier_wait(&run->barrier);
+	if (tb != NULL)
+		trace_add(tb, pid, TRACE_BARRIER, 0);
 
 	/* Data announcement phase using a shared tree */
+#ifdef _VERBOSE
 	printf("producer%d just start removing from the"
 	    " shared queue and inserting into the shared"
 	    " binary search tree\n", pid);
-	while (1) {
-#if defined _LOCK_FREE_QUEUE
-		result = lfdequeue(pinfo->queue);
-#else
-		result = dequeue(pinfo->queue);
-#endif
-		if (result == NULL)
+#endif /* _VERBOSE */
+	perf_read(&pc, &s0);
+	pinfo->announcement.start = t0 = now_ns();
+	while (announce_one(pinfo, tb, pid, &t0))
+		;
+	pinfo->announcement.end = t0;
+	perf_read(&pc, &s1);
+	perf_diff(&pinfo->announcement.perf, &s0, &s1);
+	perf_close(&pc);
+	__atomic_add_fetch(&run->done, 1, __ATOMIC_RELEASE);
+
+	return NULL;
+}
+
+/*
+ * Announcer of a streaming run: moves items from the queue
+ * to the tree until the queue is empty and stays so, that is
+ * after every producer is done.
+ */
+void *
+announce(void *arg)
+{
+	struct producerinfo *ainfo;
+	struct runinfo *run;
+	struct config *cfg;
+	struct perfcounters pc;
+	struct perfsample s0, s1;
+	struct tracebuf *tb;
+	uint64_t t0;
+	int i, tid, finished;
+
+	ainfo = (struct producerinfo *)arg;
+	run = ainfo->run;
+	cfg = run->cfg;
+	for (i = 0; i < NOPS; i++)
+		initlatency(&ainfo->lat[i]);
+	perf_open(&pc);
+	tid = cfg->nproducers + cfg->nconsumers + ainfo->id;
+	tb = (run->trace != NULL) ? &run->trace[tid] : NULL;
+
+	pthread_barrier_wait(&run->start);
+	if (tb != NULL)
+		trace_add(tb, tid, TRACE_BARRIER, 0);
+
+	perf_read(&pc, &s0);
+	ainfo->announcement.start = t0 = now_ns();
+	for (;;) {
+		finished = __atomic_load_n(&run->produced,
+		    __ATOMIC_ACQUIRE) == cfg->nproducers;
+		if (announce_one(ainfo, tb, tid, &t0))
+			continue;
+		if (finished)
 			break;
-		insert(pinfo->tree, result->producerID,
-		    result->timestamp);
+		sched_yield();
+		t0 = now_ns();
 	}
+	ainfo->announcement.end = t0;
+	perf_read(&pc, &s1);
+	perf_diff(&ainfo->announcement.perf, &s0, &s1);
+	perf_close(&pc);
+	__atomic_add_fetch(&run->done, 1, __ATOMIC_RELEASE);
 
 	return NULL;
 }
 
+/*
+ * Wait until consumer cid has an i-th item routed to it.
+ * Return 0 if it never will, because production is over.
+ */
+static int
+routed(struct runinfo *run, int cid, int i)
+{
+	int finished;
+
+	for (;;) {
+		finished = __atomic_load_n(&run->produced,
+		    __ATOMIC_ACQUIRE) == run->cfg->nproducers;
+		if (i < __atomic_load_n(&run->assigned[cid],
+		    __ATOMIC_RELAXED))
+			return 1;
+		if (finished)
+			return 0;
+		sched_yield();
+	}
+}
+
+/* Account for an item taken out of the tree by a consumer */
+static void
+consumed(struct consumerinfo *cinfo, struct tracebuf *tb, int tid,
+    struct info *inf, uint64_t ns)
+{
+	struct runinfo *run = cinfo->run;
+	uint64_t *slot;
+
+	latency_add(&cinfo->lat[OP_DELETE], ns);
+	if (run->born != NULL) {
+		slot = bornslot(run, inf->timestamp);
+		latency_add(&cinfo->lat[OP_ENDTOEND], now_ns() - *slot);
+		__atomic_store_n(slot, 0, __ATOMIC_RELEASE);
+		__atomic_fetch_sub(&run->inflight, 1, __ATOMIC_RELEASE);
+	}
+	if (tb != NULL)
+		trace_add(tb, tid, TRACE_DELETE, inf->timestamp);
+#ifdef _VERBOSE
+	printf("consumerID=%d consumed timestamp=%d"
+	    " produced by producerID=%d\n", cinfo->id,
+	    inf->timestamp, inf->producerID);
+#endif /* _VERBOSE */
+	cinfo->consumption.ops++;
+}
+
 void *
 consume(void *arg)
 {
 	struct consumerinfo *cinfo;
-	struct info *result;
-	pthread_t tid; /* threadID */
-	int pid; /* producerID */
+	struct runinfo *run;
+	struct config *cfg;
+	const struct map_ops *mops;
+	struct tree_node *result;
+	struct info inf;
 	int cid; /* consumerID */
-	int i, timestamp;
+	int tid; /* thread number, after the producers */
+	struct perfcounters pc;
+	struct perfsample s0, s1;
+	struct tracebuf *tb;
+	uint64_t t0, t1;
+	int i, timestamp, finished;
 
 	cinfo = (struct consumerinfo *)arg;
+	run = cinfo->run;
+	cfg = run->cfg;
+	cid = cinfo->id;
+	mops = cfg->mops;
+	for (i = 0; i < NOPS; i++)
+		initlatency(&cinfo->lat[i]);
+	perf_open(&pc);
+	tid = cfg->nproducers + cid;
+	tb = (run->trace != NULL) ? &run->trace[tid] : NULL;
 
-	/* Map pthread_t to int to be more readable */
-	tid = pthread_self();
-	for (i = 0; i < cinfo->nthreads; i++) {
-		if (tid == cinfo->tid[i]) {
-			cid = i;
-			break;
-		}
-	}
-	/*
-	 * Each consumer should consume data produced by
-	 * a specific producer based on his ID.
-	 * So using a modulo function, map a the consumer
-	 * to his corresponding producer.
-	 */
-	pid = modulo(cid - 1, cinfo->nthreads);
+	pthread_barrier_wait(&run->start);
+	if (tb != NULL)
+		trace_add(tb, tid, TRACE_BARRIER, 0);
 
 	/*
 	 * Same barrier used by the producers. It ensures that
@@ -207,32 +1168,83 @@ consume(void *arg)
 	 * publication has been started by the producers.
 	 * In other words, data will be announced by the
 	 * producers to the consumers and being consumed
-	 * concurrently.
+	 * concurrently. Streaming runs start right away.
 	 */
-	pthread_barrier_wait(cinfo->barrier);
+	if (!cfg->stream) {
+		pthread_barrier_wait(&run->barrier);
+		if (tb != NULL)
+			trace_add(tb, tid, TRACE_BARRIER, 0);
+	}
 
 	/* Data consuming using a shared tree */
+#ifdef _VERBOSE
 	printf("consumer%d just start removing from the"
 	    " shared binary search tree\n", cid);
-	i = 0;
-	while (i < cinfo->nthreads) {
-		timestamp = ((i * cinfo->nthreads) + pid);
-		result = delete(cinfo->tree, timestamp);
-		if (result != NULL) {
-			printf("consumerID=%d consumed timestamp=%d"
-			    " produced by producerID=%d\n", cid,
-			    result->timestamp, result->producerID);
-			i++;
+#endif /* _VERBOSE */
+	perf_read(&pc, &s0);
+	cinfo->consumption.start = now_ns();
+	if (cfg->mapping == MAPPING_ANY) {
+		/*
+		 * Take the smallest item until the tree is empty
+		 * and stays so: a failed attempt that started after
+		 * every announcer was done.
+		 */
+		for (;;) {
+			finished = __atomic_load_n(&run->done,
+			    __ATOMIC_ACQUIRE) == cfg->nannouncers;
+			t0 = now_ns();
+			if (!mops->delete_min(run->tree, &inf)) {
+				if (finished)
+					break;
+				if (cfg->stream)
+					sched_yield();
+				continue;
+			}
+			t1 = now_ns();
+			consumed(cinfo, tb, tid, &inf, t1 - t0);
+		}
+	} else {
+		/*
+		 * The items routed to this consumer, sleeping until
+		 * each is inserted if the map can, else spinning on
+		 * it. The delete latency then includes the sleep.
+		 */
+		for (i = 0; routed(run, cid, i); i++) {
+			timestamp = (i * cfg->nconsumers) + cid;
+			if (mops->wait_delete_node != NULL) {
+				t0 = now_ns();
+				result = mops->wait_delete_node(run->tree,
+				    timestamp, -1);
+				inf = result->inf;
+				destroylock(&result->lock);
+				node_free(result);
+			} else if (mops->delete_node != NULL) {
+				do {
+					t0 = now_ns();
+					result = map_delete_node(mops,
+					    run->tree, timestamp);
+				} while (result == NULL);
+				inf = result->inf;
+				destroylock(&result->lock);
+				node_free(result);
+			} else {
+				do {
+					t0 = now_ns();
+				} while (!mops->delete(run->tree, timestamp,
+				    &inf));
+			}
+			t1 = now_ns();
+			consumed(cinfo, tb, tid, &inf, t1 - t0);
 		}
 	}
-	printf("consumerID=%d consumed %d chunks of data\n",
-	    cid, i);
+	cinfo->consumption.end = now_ns();
+	perf_read(&pc, &s1);
+	perf_diff(&cinfo->consumption.perf, &s0, &s1);
+	perf_close(&pc);
+#ifdef _VERBOSE
+	printf("consumerID=%d consumed %ld chunks of data\n",
+	    cid, cinfo->consumption.ops);
+#endif /* _VERBOSE */
 
 	return NULL;
 }
-
-int
-modulo(int x, int y)
-{
-	return (x % y + y) % y;
-}
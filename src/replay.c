@@ -0,0 +1,271 @@
+/*
+ * Author: Giannis Giakoumakis
+ * Contact: giannis.m.giakoumakis@gmail.com
+ *
+ * Replay a trace recorded by prodcons -R against any queue
+ * and tree implementation, with one thread per recorded
+ * thread and nothing but the operations in the loop.
+ *
+ * A trace only holds operations that succeeded, so a
+ * dequeue or a delete that fails during replay (its item is
+ * not there yet) is retried until it succeeds; the retries
+ * are reported. Barrier records make every thread wait for
+ * the others, like they did while recording.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/affinity.h"
+#include "../include/backend.h"
+#include "../include/measure.h"
+#include "../include/pthread_barrier.h"
+#include "../include/trace.h"
+
+static const char *opnames[NTRACEOPS] = {
+	"enqueue", "dequeue", "insert", "delete", "barrier"
+};
+
+struct replayinfo {
+	struct trace *trace;
+	const struct queue_ops *qops;
+	const struct map_ops *mops;
+	void *queue;
+	void *tree;
+	pthread_barrier_t barrier;
+};
+
+struct replayer {
+	int id;
+	struct replayinfo *ri;
+	long ops[NTRACEOPS];
+	long retries;
+	pthread_t tid;
+};
+
+static void *
+replay(void *arg)
+{
+	struct replayer *r = arg;
+	struct replayinfo *ri = r->ri;
+	const struct tracerec *rec, *end;
+	struct info inf;
+
+	rec = ri->trace->recs[r->id];
+	end = rec + ri->trace->count[r->id];
+	for (; rec < end; rec++) {
+		switch (rec->op) {
+		case TRACE_ENQUEUE:
+			queue_enqueue(ri->qops, ri->queue, r->id, rec->key);
+			break;
+		case TRACE_DEQUEUE:
+			while (!ri->qops->dequeue(ri->queue, &inf))
+				r->retries++;
+			break;
+		case TRACE_INSERT:
+			ri->mops->insert(ri->tree, r->id, rec->key);
+			break;
+		case TRACE_DELETE:
+			while (!ri->mops->delete(ri->tree, rec->key, &inf))
+				r->retries++;
+			break;
+		case TRACE_BARRIER:
+			pthread_barrier_wait(&ri->barrier);
+			break;
+		default:
+			printf("replay: bad record %u\n", rec->op);
+			exit(EXIT_FAILURE);
+		}
+		r->ops[rec->op]++;
+	}
+	return NULL;
+}
+
+/*
+ * Run a replay once with fresh data structures and return
+ * its duration in seconds.
+ */
+static double
+runonce(struct replayinfo *ri, struct affinity *aff, long *ops,
+    long *retries)
+{
+	struct replayer *r;
+	pthread_attr_t attr;
+	uint64_t t0, t1;
+	int n, e, i, j;
+
+	n = ri->trace->nthreads;
+	r = calloc(n, sizeof(struct replayer));
+	if (r == NULL) {
+		printf("malloc() failed\n");
+		exit(EXIT_FAILURE);
+	}
+	ri->queue = ri->qops->create();
+	ri->tree = ri->mops->create();
+	e = pthread_barrier_init(&ri->barrier, NULL, n);
+	if (e != 0) {
+		printf("pthread_barrier_init() failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	t0 = now_ns();
+	for (i = 0; i < n; i++) {
+		r[i].id = i;
+		r[i].ri = ri;
+		affinity_attr(aff, i, &attr);
+		e = pthread_create(&r[i].tid, &attr, replay, &r[i]);
+		if (e != 0) {
+			printf("pthread_create() failed\n");
+			exit(EXIT_FAILURE);
+		}
+		pthread_attr_destroy(&attr);
+	}
+	for (i = 0; i < n; i++) {
+		e = pthread_join(r[i].tid, NULL);
+		if (e != 0) {
+			printf("pthread_join() failed\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	t1 = now_ns();
+
+	memset(ops, 0, NTRACEOPS * sizeof(long));
+	*retries = 0;
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < NTRACEOPS; j++)
+			ops[j] += r[i].ops[j];
+		*retries += r[i].retries;
+	}
+
+	pthread_barrier_destroy(&ri->barrier);
+	ri->qops->destroy(ri->queue);
+	ri->mops->destroy(ri->tree);
+	free(r);
+	return (t1 - t0) / 1e9;
+}
+
+static void
+usage(int exit_code)
+{
+	int i;
+
+	printf("usage: ./replay [options] TRACE\n"
+	    "\t-r, --repetitions=R  replays (default 1)\n"
+	    "\t-f, --format=F       human or csv (default human)\n"
+	    "\t-a, --affinity=A     thread placement, as in prodcons"
+	    " (default none)\n"
+	    "\t-q, --queue=Q        queue implementation:");
+	for (i = 0; queue_backends[i] != NULL; i++)
+		printf(" %s", queue_backends[i]->name);
+	printf(" (default %s)\n"
+	    "\t-t, --tree=T         tree implementation:",
+	    queue_backends[0]->name);
+	for (i = 0; map_backends[i] != NULL; i++)
+		printf(" %s", map_backends[i]->name);
+	printf(" (default %s)\n", map_backends[0]->name);
+	exit(exit_code);
+}
+
+int
+main(int argc, char **argv)
+{
+	static struct option longopts[] = {
+		{ "repetitions", required_argument, NULL, 'r' },
+		{ "format",	 required_argument, NULL, 'f' },
+		{ "affinity",	 required_argument, NULL, 'a' },
+		{ "queue",	 required_argument, NULL, 'q' },
+		{ "tree",	 required_argument, NULL, 't' },
+		{ "help",	 no_argument,	    NULL, 'h' },
+		{ NULL,		 0,		    NULL, 0 }
+	};
+	struct replayinfo ri;
+	struct trace trace;
+	struct affinity aff;
+	long ops[NTRACEOPS], retries, total;
+	double seconds;
+	int repetitions, csv, opt, i, j;
+
+	repetitions = 1;
+	csv = 0;
+	parse_affinity(&aff, "none");
+	ri.qops = queue_backends[0];
+	ri.mops = map_backends[0];
+
+	while ((opt = getopt_long(argc, argv, "r:f:a:q:t:h", longopts,
+	    NULL)) != -1) {
+		switch (opt) {
+		case 'r':
+			repetitions = atoi(optarg);
+			break;
+		case 'f':
+			if (strcmp(optarg, "human") == 0)
+				csv = 0;
+			else if (strcmp(optarg, "csv") == 0)
+				csv = 1;
+			else
+				usage(EXIT_FAILURE);
+			break;
+		case 'a':
+			free_affinity(&aff);
+			if (parse_affinity(&aff, optarg) != 0)
+				usage(EXIT_FAILURE);
+			break;
+		case 'q':
+			ri.qops = find_queue_ops(optarg);
+			if (ri.qops == NULL)
+				usage(EXIT_FAILURE);
+			break;
+		case 't':
+			ri.mops = find_map_ops(optarg);
+			if (ri.mops == NULL)
+				usage(EXIT_FAILURE);
+			break;
+		case 'h':
+			usage(EXIT_SUCCESS);
+		default:
+			usage(EXIT_FAILURE);
+		}
+	}
+	if (optind != argc - 1 || repetitions <= 0)
+		usage(EXIT_FAILURE);
+
+	if (trace_map(argv[optind], &trace) != 0) {
+		printf("%s: %s\n", argv[optind], (errno == EINVAL) ?
+		    "not a trace" : strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	ri.trace = &trace;
+	affinity_apply(&aff, 0);
+
+	if (csv)
+		printf("rep,queue,tree,threads,seconds,ops,ops_per_sec,"
+		    "enqueues,dequeues,inserts,deletes,retries\n");
+	for (i = 1; i <= repetitions; i++) {
+		seconds = runonce(&ri, &aff, ops, &retries);
+		total = 0;
+		for (j = 0; j < TRACE_BARRIER; j++)
+			total += ops[j];
+		if (csv)
+			printf("%d,%s,%s,%d,%.6f,%ld,%.0f,%ld,%ld,%ld,%ld,%ld\n",
+			    i, ri.qops->name, ri.mops->name, trace.nthreads,
+			    seconds, total, total / seconds, ops[TRACE_ENQUEUE],
+			    ops[TRACE_DEQUEUE], ops[TRACE_INSERT],
+			    ops[TRACE_DELETE], retries);
+		else {
+			printf("replay %d: queue=%s tree=%s threads=%d"
+			    " %.4f s, %ld ops, %.0f ops/sec, %ld retries\n ",
+			    i, ri.qops->name, ri.mops->name, trace.nthreads,
+			    seconds, total, total / seconds, retries);
+			for (j = 0; j < TRACE_BARRIER; j++)
+				printf(" %s=%ld", opnames[j], ops[j]);
+			printf("\n");
+		}
+	}
+
+	trace_unmap(&trace);
+	free_affinity(&aff);
+	return 0;
+}
@@ -0,0 +1,131 @@
+/*
+ * Author: Giannis Giakoumakis
+ * Contact: giannis.m.giakoumakis@gmail.com
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/stats.h"
+
+#ifdef _STATS
+
+__thread struct threadstats *mystats = NULL;
+
+/*
+ * Blocks of every thread that ever counted anything. They
+ * outlive their threads, so the counts of joined threads
+ * still add up.
+ */
+static struct threadstats *allstats = NULL;
+static pthread_mutex_t allstats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void
+stats_register(void)
+{
+	struct threadstats *ts;
+
+	ts = aligned_alloc(64, sizeof(struct threadstats));
+	if (ts == NULL) {
+		printf("malloc() failed\n");
+		exit(EXIT_FAILURE);
+	}
+	memset(ts, 0, sizeof(struct threadstats));
+
+	pthread_mutex_lock(&allstats_lock);
+	ts->next = allstats;
+	allstats = ts;
+	pthread_mutex_unlock(&allstats_lock);
+	mystats = ts;
+}
+
+static double
+ratio(uint64_t a, uint64_t b)
+{
+	return (b > 0) ? (double)a / b : 0;
+}
+
+/*
+ * Counters of running threads are read without
+ * synchronization, so dump after joining them.
+ */
+void
+stats_dump(FILE *f)
+{
+	struct threadstats *ts;
+	uint64_t c[NSTATS];
+	int i;
+
+	memset(c, 0, sizeof(c));
+	pthread_mutex_lock(&allstats_lock);
+	for (ts = allstats; ts != NULL; ts = ts->next)
+		for (i = 0; i < NSTATS; i++) {
+			if (i == STAT_DEPTH_MAX) {
+				if (ts->c[i] > c[i])
+					c[i] = ts->c[i];
+			} else
+				c[i] += ts->c[i];
+		}
+	pthread_mutex_unlock(&allstats_lock);
+
+	fprintf(f, "statistics:\n");
+	fprintf(f, "  lock free:       %llu CAS, %llu failed (%.2f%%)\n",
+	    (unsigned long long)c[STAT_CAS],
+	    (unsigned long long)c[STAT_CAS_FAILED],
+	    100 * ratio(c[STAT_CAS_FAILED], c[STAT_CAS]));
+	fprintf(f, "  empty dequeues:  %llu\n",
+	    (unsigned long long)c[STAT_EMPTY]);
+	fprintf(f, "  eliminated:      %llu push/pop pairs\n",
+	    (unsigned long long)c[STAT_ELIMINATED]);
+	fprintf(f, "  head_lock:       %llu acquired, %llu contended,"
+	    " %.0f ns waited per contended\n",
+	    (unsigned long long)c[STAT_HEAD_LOCKS],
+	    (unsigned long long)c[STAT_HEAD_CONTENDED],
+	    ratio(c[STAT_HEAD_WAIT_NS], c[STAT_HEAD_CONTENDED]));
+	fprintf(f, "  tail_lock:       %llu acquired, %llu contended,"
+	    " %.0f ns waited per contended\n",
+	    (unsigned long long)c[STAT_TAIL_LOCKS],
+	    (unsigned long long)c[STAT_TAIL_CONTENDED],
+	    ratio(c[STAT_TAIL_WAIT_NS], c[STAT_TAIL_CONTENDED]));
+	fprintf(f, "  insert:          %llu calls, %.2f nodes locked per"
+	    " call\n", (unsigned long long)c[STAT_INSERTS],
+	    ratio(c[STAT_INSERT_LOCKED], c[STAT_INSERTS]));
+	fprintf(f, "  delete:          %llu calls, %.2f nodes locked per"
+	    " call\n", (unsigned long long)c[STAT_DELETES],
+	    ratio(c[STAT_DELETE_LOCKED], c[STAT_DELETES]));
+	fprintf(f, "  findhelper:      %llu calls, %.2f nodes locked per"
+	    " call\n", (unsigned long long)c[STAT_FINDHELPERS],
+	    ratio(c[STAT_FINDHELPER_LOCKED], c[STAT_FINDHELPERS]));
+	fprintf(f, "  tree depth:      %.2f average, %llu max\n",
+	    ratio(c[STAT_DEPTH_SUM], c[STAT_INSERTS] + c[STAT_DELETES]),
+	    (unsigned long long)c[STAT_DEPTH_MAX]);
+}
+
+void
+stats_reset(void)
+{
+	struct threadstats *ts;
+
+	pthread_mutex_lock(&allstats_lock);
+	for (ts = allstats; ts != NULL; ts = ts->next) {
+		memset(ts->c, 0, sizeof(ts->c));
+		ts->depth = 0;
+	}
+	pthread_mutex_unlock(&allstats_lock);
+}
+
+#else /* !_STATS */
+
+void
+stats_dump(FILE *f)
+{
+	(void)f;
+}
+
+void
+stats_reset(void)
+{
+}
+
+#endif /* _STATS */
@@ -0,0 +1,142 @@
+/*
+ * Author: Giannis Giakoumakis
+ * Contact: giannis.m.giakoumakis@gmail.com
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../include/trace.h"
+
+void
+inittracebuf(struct tracebuf *b)
+{
+	b->recs = NULL;
+	b->n = 0;
+	b->size = 0;
+}
+
+void
+tracebuf_free(struct tracebuf *b)
+{
+	free(b->recs);
+	inittracebuf(b);
+}
+
+void
+grow_tracebuf(struct tracebuf *b)
+{
+	b->size = (b->size == 0) ? 4096 : b->size * 2;
+	b->recs = realloc(b->recs, b->size * sizeof(struct tracerec));
+	if (b->recs == NULL) {
+		printf("realloc() failed\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+int
+trace_write(const char *path, struct tracebuf *bufs, int nthreads)
+{
+	struct traceheader h;
+	uint64_t count;
+	FILE *f;
+	int i, ok;
+
+	f = fopen(path, "wb");
+	if (f == NULL)
+		return -1;
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, TRACE_MAGIC, sizeof(h.magic));
+	h.version = TRACE_VERSION;
+	h.nthreads = nthreads;
+	h.nrecords = 0;
+	for (i = 0; i < nthreads; i++)
+		h.nrecords += bufs[i].n;
+
+	ok = fwrite(&h, sizeof(h), 1, f) == 1;
+	for (i = 0; ok && i < nthreads; i++) {
+		count = bufs[i].n;
+		ok = fwrite(&count, sizeof(count), 1, f) == 1;
+	}
+	for (i = 0; ok && i < nthreads; i++)
+		if (bufs[i].n > 0)
+			ok = fwrite(bufs[i].recs, sizeof(struct tracerec),
+			    bufs[i].n, f) == bufs[i].n;
+	if (fclose(f) != 0)
+		ok = 0;
+	return ok ? 0 : -1;
+}
+
+int
+trace_map(const char *path, struct trace *t)
+{
+	const struct traceheader *h;
+	const struct tracerec *r;
+	struct stat st;
+	uint64_t total;
+	size_t need;
+	int fd, i;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(*h)) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+	/* populate up front, so replay does not take page faults */
+	t->len = st.st_size;
+	t->map = mmap(NULL, t->len, PROT_READ, MAP_PRIVATE | MAP_POPULATE,
+	    fd, 0);
+	close(fd);
+	if (t->map == MAP_FAILED)
+		return -1;
+
+	h = t->map;
+	need = sizeof(*h) + (size_t)h->nthreads * sizeof(uint64_t);
+	if (memcmp(h->magic, TRACE_MAGIC, sizeof(h->magic)) != 0 ||
+	    h->version != TRACE_VERSION || h->nthreads == 0 ||
+	    h->nthreads > UINT16_MAX || need > t->len ||
+	    h->nrecords > (t->len - need) / sizeof(struct tracerec) ||
+	    need + h->nrecords * sizeof(struct tracerec) != t->len)
+		goto invalid;
+
+	t->nthreads = (int)h->nthreads;
+	t->count = (const uint64_t *)(h + 1);
+	t->recs = malloc(t->nthreads * sizeof(struct tracerec *));
+	if (t->recs == NULL) {
+		printf("malloc() failed\n");
+		exit(EXIT_FAILURE);
+	}
+	r = (const struct tracerec *)((const char *)t->map + need);
+	total = 0;
+	for (i = 0; i < t->nthreads; i++) {
+		t->recs[i] = r + total;
+		total += t->count[i];
+	}
+	if (total != h->nrecords) {
+		free(t->recs);
+		goto invalid;
+	}
+	return 0;
+
+invalid:
+	munmap(t->map, t->len);
+	errno = EINVAL;
+	return -1;
+}
+
+void
+trace_unmap(struct trace *t)
+{
+	free(t->recs);
+	munmap(t->map, t->len);
+}
@@ -0,0 +1,199 @@
+/*
+ * Author: Giannis Giakoumakis
+ * Contact: giannis.m.giakoumakis@gmail.com
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../include/treefile.h"
+
+int
+tree_save(struct tree *t, const char *path)
+{
+	struct treefileheader h;
+	struct tree_snapshot s;
+	char *tmp;
+	FILE *f;
+	int ok, e;
+
+	tmp = malloc(strlen(path) + sizeof(".tmp"));
+	if (tmp == NULL) {
+		printf("malloc() failed\n");
+		exit(EXIT_FAILURE);
+	}
+	sprintf(tmp, "%s.tmp", path);
+	f = fopen(tmp, "wb");
+	if (f == NULL) {
+		free(tmp);
+		return -1;
+	}
+
+	/* a snapshot comes sorted, as the file wants it */
+	snapshot_tree(t, INT_MIN, INT_MAX, &s);
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, TREEFILE_MAGIC, sizeof(h.magic));
+	h.version = TREEFILE_VERSION;
+	h.nitems = s.nitems;
+	ok = fwrite(&h, sizeof(h), 1, f) == 1;
+	if (ok && s.nitems > 0)
+		ok = fwrite(s.items, sizeof(struct info), s.nitems, f) ==
+		    (size_t)s.nitems;
+	snapshot_free(&s);
+	if (ok && fflush(f) != 0)
+		ok = 0;
+	if (ok && fsync(fileno(f)) != 0)
+		ok = 0;
+	if (fclose(f) != 0)
+		ok = 0;
+	if (ok && rename(tmp, path) != 0)
+		ok = 0;
+	if (!ok) {
+		e = errno;
+		unlink(tmp);
+		errno = e;
+	}
+	free(tmp);
+	return ok ? 0 : -1;
+}
+
+long
+tree_load(struct tree *t, const char *path)
+{
+	const struct treefileheader *h;
+	struct info *items;
+	struct stat st;
+	size_t len;
+	void *map;
+	long n, i;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(*h)) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+	/* read once from start to end, populating is cheaper */
+	len = st.st_size;
+	map = mmap(NULL, len, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	h = map;
+	if (memcmp(h->magic, TREEFILE_MAGIC, sizeof(h->magic)) != 0 ||
+	    h->version != TREEFILE_VERSION || h->nitems > INT_MAX ||
+	    h->nitems != (len - sizeof(*h)) / sizeof(struct info) ||
+	    (len - sizeof(*h)) % sizeof(struct info) != 0)
+		goto invalid;
+	n = (long)h->nitems;
+	items = (struct info *)(h + 1);
+
+	/* insert_bulk() expects increasing keys */
+	for (i = 1; i < n; i++)
+		if (items[i - 1].timestamp >= items[i].timestamp)
+			goto invalid;
+	insert_bulk(t, items, (int)n);
+	munmap(map, len);
+	return n;
+
+invalid:
+	munmap(map, len);
+	errno = EINVAL;
+	return -1;
+}
+
+#ifdef _UTEST
+
+#define NUM_KEYS 100000
+
+static int
+height(struct tree_node *n)
+{
+	int l, r;
+
+	if (n == NULL)
+		return 0;
+	l = height(n->lc);
+	r = height(n->rc);
+	return 1 + ((l > r) ? l : r);
+}
+
+int
+main()
+{
+	struct tree t, u;
+	struct tree_snapshot a, b;
+	const char *path = "treefile.snap";
+	FILE *f;
+	long n;
+	int i;
+
+	inittree(&t);
+	inittree(&u);
+	printf("This is just a test. Two trees have been initialized.\n");
+
+	/* keys in an order that makes a fairly deep tree */
+	for (i = 0; i < NUM_KEYS; i++)
+		insert(&t, i % 7, (int)(((long)i * 7919) % NUM_KEYS));
+	printf("saved tree: %ld nodes, height %d\n", tree_size(&t),
+	    height(t.root));
+	if (tree_save(&t, path) != 0) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	n = tree_load(&u, path);
+	if (n < 0) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	unlink(path);
+	printf("loaded tree: %ld nodes, height %d\n", n, height(u.root));
+
+	snapshot_tree(&t, INT_MIN, INT_MAX, &a);
+	snapshot_tree(&u, INT_MIN, INT_MAX, &b);
+	if (a.nitems != b.nitems || tree_size_approx(&u) != n ||
+	    memcmp(a.items, b.items, a.nitems * sizeof(struct info)) != 0) {
+		printf("the loaded tree differs from the saved one\n");
+		exit(EXIT_FAILURE);
+	}
+	snapshot_free(&a);
+	snapshot_free(&b);
+
+	/* a balanced tree of 100000 nodes is 17 levels high */
+	if (height(u.root) > 17) {
+		printf("the loaded tree is not balanced\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* a file that is not a snapshot is refused */
+	f = fopen(path, "w");
+	if (f == NULL) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	fprintf(f, "This is not a snapshot, but it is long enough.\n");
+	fclose(f);
+	n = tree_load(&u, path);
+	unlink(path);
+	if (n != -1 || errno != EINVAL) {
+		printf("tree_load() accepted a bad file\n");
+		exit(EXIT_FAILURE);
+	}
+	destroytree(&t);
+	destroytree(&u);
+
+	return 0;
+}
+
+#endif /* _UTEST */
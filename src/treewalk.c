@@ -0,0 +1,320 @@
+/*
+ * Author: Giannis Giakoumakis
+ * Contact: giannis.m.giakoumakis@gmail.com
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../include/nodealloc.h"
+#include "../include/treewalk.h"
+
+/* Rounds of splitting, so a degenerate tree stops early */
+#define MAXROUNDS 32
+
+struct piece {
+	struct tree_node *node;
+	int whole;	/* the subtree of node, or node alone */
+	long start;	/* in-order position of its first value */
+	long count;	/* values in it */
+};
+
+enum job {
+	JOB_COUNT,
+	JOB_WALK,
+	JOB_FREE
+};
+
+struct walk {
+	struct piece *pieces;
+	int npieces;
+	int next;	/* next piece to take */
+	enum job job;
+	void (*func)(struct info *, long, void *);
+	void *arg;
+};
+
+static struct piece *
+allocpieces(int n)
+{
+	struct piece *p;
+
+	p = malloc(n * sizeof(struct piece));
+	if (p == NULL) {
+		printf("malloc() failed\n");
+		exit(EXIT_FAILURE);
+	}
+	return p;
+}
+
+/*
+ * Split the tree under root into at least target subtrees if
+ * it has enough nodes, replacing a subtree by its left subtree,
+ * its root alone and its right subtree, level by level. Pieces
+ * come out in in-order.
+ */
+static struct piece *
+split(struct tree_node *root, int target, int *npieces)
+{
+	struct piece *p, *q;
+	struct tree_node *n;
+	int i, m, whole, round, changed;
+
+	*npieces = 0;
+	if (root == NULL)
+		return NULL;
+	p = allocpieces(1);
+	p[0].node = root;
+	p[0].whole = 1;
+	*npieces = 1;
+	whole = 1;
+	for (round = 0; round < MAXROUNDS && whole < target; round++) {
+		q = allocpieces(3 * *npieces);
+		m = 0;
+		whole = 0;
+		changed = 0;
+		for (i = 0; i < *npieces; i++) {
+			n = p[i].node;
+			if (!p[i].whole || (n->lc == NULL && n->rc == NULL)) {
+				q[m++] = p[i];
+				whole += p[i].whole;
+				continue;
+			}
+			if (n->lc != NULL) {
+				q[m].node = n->lc;
+				q[m++].whole = 1;
+				whole++;
+			}
+			q[m].node = n;
+			q[m++].whole = 0;
+			if (n->rc != NULL) {
+				q[m].node = n->rc;
+				q[m++].whole = 1;
+				whole++;
+			}
+			changed = 1;
+		}
+		free(p);
+		p = q;
+		*npieces = m;
+		if (!changed)
+			break;
+	}
+	return p;
+}
+
+/*
+ * In-order walk of a subtree without recursion or a stack
+ * (Morris' traversal): the right pointer of the predecessor
+ * of a node leads back to it while its left subtree is being
+ * walked, and is reset afterwards. Call func with consecutive
+ * positions from pos on, if not NULL. Return the number of
+ * nodes.
+ */
+static long
+inorder(struct tree_node *n, long pos,
+    void (*func)(struct info *, long, void *), void *arg)
+{
+	struct tree_node *pre;
+	long count = 0;
+
+	while (n != NULL) {
+		if (n->lc != NULL) {
+			pre = n->lc;
+			while (pre->rc != NULL && pre->rc != n)
+				pre = pre->rc;
+			if (pre->rc == NULL) {
+				pre->rc = n;
+				n = n->lc;
+				continue;
+			}
+			pre->rc = NULL;
+		}
+		if (func != NULL)
+			func(&n->inf, pos + count, arg);
+		count++;
+		n = n->rc;
+	}
+	return count;
+}
+
+static void *
+worker(void *arg)
+{
+	struct walk *w = arg;
+	struct piece *p;
+	int i;
+
+	while ((i = __atomic_fetch_add(&w->next, 1, __ATOMIC_RELAXED)) <
+	    w->npieces) {
+		p = &w->pieces[i];
+		switch (w->job) {
+		case JOB_COUNT:
+			p->count = p->whole ? inorder(p->node, 0, NULL, NULL) : 1;
+			break;
+		case JOB_WALK:
+			if (p->whole)
+				inorder(p->node, p->start, w->func, w->arg);
+			else
+				w->func(&p->node->inf, p->start, w->arg);
+			break;
+		case JOB_FREE:
+			/* the children of a lone node belong to other pieces */
+			if (p->whole)
+				destroysubtree(p->node);
+			else {
+				destroylock(&p->node->lock);
+				node_free(p->node);
+			}
+			break;
+		}
+	}
+	return NULL;
+}
+
+/* Hand the pieces to nthreads workers, the caller included */
+static void
+run(struct walk *w, enum job job, int nthreads)
+{
+	pthread_t *tid;
+	int i, e;
+
+	w->job = job;
+	w->next = 0;
+	tid = malloc(nthreads * sizeof(pthread_t));
+	if (tid == NULL) {
+		printf("malloc() failed\n");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 1; i < nthreads; i++) {
+		e = pthread_create(&tid[i], NULL, worker, w);
+		if (e != 0) {
+			printf("pthread_create() failed\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	worker(w);
+	for (i = 1; i < nthreads; i++) {
+		e = pthread_join(tid[i], NULL);
+		if (e != 0) {
+			printf("pthread_join() failed\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	free(tid);
+}
+
+void
+tree_walk_parallel(struct tree *t, int nthreads,
+    void (*func)(struct info *, long, void *), void *arg)
+{
+	struct walk w;
+	long pos;
+	int i;
+
+	if (nthreads < 1)
+		nthreads = 1;
+	w.pieces = split(t->root, nthreads * TREEWALK_PIECES, &w.npieces);
+	w.func = func;
+	w.arg = arg;
+
+	/* count first, so every piece knows where its output goes */
+	run(&w, JOB_COUNT, nthreads);
+	pos = 0;
+	for (i = 0; i < w.npieces; i++) {
+		w.pieces[i].start = pos;
+		pos += w.pieces[i].count;
+	}
+	run(&w, JOB_WALK, nthreads);
+	free(w.pieces);
+}
+
+void
+destroytree_parallel(struct tree *t, int nthreads)
+{
+	struct walk w;
+
+	if (nthreads < 1)
+		nthreads = 1;
+	w.pieces = split(t->root, nthreads * TREEWALK_PIECES, &w.npieces);
+	w.func = NULL;
+	w.arg = NULL;
+	run(&w, JOB_FREE, nthreads);
+	free(w.pieces);
+	t->root = NULL;
+	initcounter(&t->size);
+}
+
+#ifdef _UTEST
+
+#define NUM_THREADS 4
+#define NUM_KEYS 100000
+
+struct info out[NUM_KEYS];
+
+/* Nodes allocated (or freed) on every NUMA node */
+long
+nodecount(int frees)
+{
+	struct nodestats ns;
+	long n = 0;
+	int i;
+
+	for (i = 0; i < numa_nodes() && i < NODEALLOC_MAXNODES; i++) {
+		nodealloc_stats(i, &ns);
+		n += frees ? ns.frees : ns.allocs;
+	}
+	return n;
+}
+
+void
+store(struct info *inf, long pos, void *arg)
+{
+	out[pos] = *inf;
+}
+
+int
+main()
+{
+	struct tree t;
+	long allocs, frees;
+	int i;
+
+	inittree(&t);
+	printf("This is just a test. A tree has been initialized.\n");
+
+	/* keys in a scattered order, so the tree is not a list */
+	nodealloc_reset();
+	for (i = 0; i < NUM_KEYS; i++)
+		insert(&t, i % NUM_THREADS,
+		    (int)(((long)i * 7919) % NUM_KEYS));
+	allocs = nodecount(0);
+
+	tree_walk_parallel(&t, NUM_THREADS, store, NULL);
+	for (i = 0; i < NUM_KEYS; i++)
+		if (out[i].timestamp != i) {
+			printf("position %d holds timestamp=%d\n", i,
+			    out[i].timestamp);
+			exit(EXIT_FAILURE);
+		}
+	printf("%d values walked in order\n", NUM_KEYS);
+
+	/* the walk leaves the tree as it found it */
+	if (tree_size(&t) != NUM_KEYS) {
+		printf("the walk changed the tree\n");
+		exit(EXIT_FAILURE);
+	}
+
+	destroytree_parallel(&t, NUM_THREADS);
+	frees = nodecount(1);
+	printf("%ld nodes allocated, %ld freed\n", allocs, frees);
+	if (frees != allocs || t.root != NULL) {
+		printf("destroytree_parallel() missed nodes\n");
+		exit(EXIT_FAILURE);
+	}
+
+	return 0;
+}
+
+#endif /* _UTEST */